@@ -0,0 +1,158 @@
+// environment lighting sampleLight can aim at, included by raytrace_common.glsl. either an equirectangular hdr map or
+// the sun lobe of the procedural sky. the map's top row looks straight up (-y), u runs around the horizon starting at +x.
+// texels are piecewise constant, so the cdfs and the lookups agree exactly
+
+// uploaded by VulkanEngine::upload_environment_map
+layout (std430, binding = 29) readonly buffer EnvironmentMap {
+    uint envWidth;
+    uint envHeight;
+    uint envEnabled; // 0 = analytic sky
+    float envIntensity;
+    vec4 envTexels[]; // rgb radiance, row major
+};
+
+// marginal cdf over the rows (envHeight + 1 entries), then the conditional cdf of each row (envWidth + 1 entries each).
+// texels are weighted by luminance * sin(theta) so the pdf is proportional to what they contribute over the sphere
+layout (std430, binding = 30) readonly buffer EnvironmentDistribution {
+    float envCDF[];
+};
+
+bool environmentMapActive() {
+    return envEnabled != 0 && envWidth > 0 && PushConstants.environment.lightDir.w == 1;
+}
+
+// the procedural sky's sun, replaced by the map when one is loaded
+bool sunActive() {
+    EnvironmentData env = PushConstants.environment;
+    return !environmentMapActive() && env.lightDir.w == 1 && env.zenithColor.w > 0.f && dot(env.lightDir.xyz, env.lightDir.xyz) > 0.f;
+}
+
+// probability that sampleLight picks the environment over the emitters
+float environmentSelectPMF() {
+    if (!environmentMapActive() && !sunActive()) return 0.f;
+    return PushConstants.rayTracerParams.lightCount == 0 ? 1.f : 0.5f;
+}
+
+uvec2 environmentTexel(vec3 dir) {
+    float theta = acos(clamp(-dir.y, -1.f, 1.f));
+    float phi = atan(dir.z, dir.x);
+    if (phi < 0.f) phi += 2.f * PI;
+    uint x = min(uint(phi / (2.f * PI) * envWidth), envWidth - 1);
+    uint y = min(uint(theta / PI * envHeight), envHeight - 1);
+    return uvec2(x, y);
+}
+
+vec3 environmentRadiance(vec3 dir) {
+    uvec2 texel = environmentTexel(dir);
+    return envTexels[texel.y * envWidth + texel.x].rgb * envIntensity;
+}
+
+// probability of the texel among all of them
+float environmentTexelPMF(uvec2 texel) {
+    uint row = envHeight + 1 + texel.y * (envWidth + 1);
+    return (envCDF[texel.y + 1] - envCDF[texel.y]) * (envCDF[row + texel.x + 1] - envCDF[row + texel.x]);
+}
+
+// solid angle pdf of sampleEnvironmentMap, without the selection probability
+float environmentMapPDF(vec3 dir) {
+    float sinTheta = sqrt(max(1.f - dir.y * dir.y, 0.f));
+    if (sinTheta <= 0.f) return 0.f;
+    return environmentTexelPMF(environmentTexel(dir)) * envWidth * envHeight / (2.f * PI * PI * sinTheta);
+}
+
+// bin of u in the count entry cdf starting at first, bins that cannot be picked are skipped
+uint searchCDF(uint first, uint count, float u) {
+    uint low = 0;
+    uint high = count - 1;
+    while (low < high) {
+        uint middle = (low + high) / 2;
+        if (envCDF[first + middle + 1] <= u) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// row from the marginal cdf, then the column from that row's conditional cdf. selectPMF scales the pdf
+LightSample sampleEnvironmentMap(vec2 u, float selectPMF) {
+    uint y = searchCDF(0, envHeight, u.x);
+    uint row = envHeight + 1 + y * (envWidth + 1);
+    uint x = searchCDF(row, envWidth, u.y);
+
+    // where u landed inside the texel, so the whole texel gets covered
+    float rowPMF = envCDF[y + 1] - envCDF[y];
+    float columnPMF = envCDF[row + x + 1] - envCDF[row + x];
+    float v = (y + clamp((u.x - envCDF[y]) / rowPMF, 0.f, 1.f)) / envHeight;
+    float w = (x + clamp((u.y - envCDF[row + x]) / columnPMF, 0.f, 1.f)) / envWidth;
+
+    float theta = v * PI;
+    float phi = w * 2.f * PI;
+    float sinTheta = sin(theta);
+
+    LightSample light;
+    light.dir = vec3(sinTheta * cos(phi), -cos(theta), sinTheta * sin(phi));
+    light.dst = 99999999.f;
+    light.emission = envTexels[y * envWidth + x].rgb * envIntensity;
+    light.light = LIGHT_ENVIRONMENT;
+    light.pdf = sinTheta > 0.f ? selectPMF * rowPMF * columnPMF * envWidth * envHeight / (2.f * PI * PI * sinTheta) : 0.f;
+    return light;
+}
+
+// sun lobe of the procedural sky, horizonColor.w is its focus and zenithColor.w its intensity. the sun sits opposite
+// lightDir and is hidden below the horizon. lightDir isn't kept normalized, its length just scales the lobe
+float sunStrength(vec3 dir) {
+    EnvironmentData env = PushConstants.environment;
+    if (dir.y > 0.f) return 0.f;
+    return pow(max(0.f, dot(dir, -env.lightDir.xyz)), env.horizonColor.w) * env.zenithColor.w;
+}
+
+// the lobe is cos^focus around the sun, so it can be sampled exactly like a phong lobe
+float sunPDF(vec3 dir) {
+    EnvironmentData env = PushConstants.environment;
+    float cosine = dot(dir, -normalize(env.lightDir.xyz));
+    if (cosine <= 0.f) return 0.f;
+    return (env.horizonColor.w + 1.f) * 0.5f * INV_PI * pow(cosine, env.horizonColor.w);
+}
+
+// radiance of the sun over its pdf is the same for every direction above the horizon, so sunlit diffuse surfaces
+// converge as fast as their shadow rays allow
+LightSample sampleSun(vec2 u, float selectPMF) {
+    EnvironmentData env = PushConstants.environment;
+    vec3 axis = -normalize(env.lightDir.xyz);
+    float cosTheta = pow(u.x, 1.f / (env.horizonColor.w + 1.f));
+    float sinTheta = sqrt(max(1.f - cosTheta * cosTheta, 0.f));
+    float phi = 2.f * PI * u.y;
+
+    vec3 nonParallelAxis = abs(axis.x) < 0.9f ? vec3(1.f, 0.f, 0.f) : vec3(0.f, 0.f, 1.f);
+    vec3 t = normalize(cross(axis, nonParallelAxis));
+    vec3 b = cross(axis, t);
+
+    LightSample light;
+    light.dir = normalize(t * (sinTheta * cos(phi)) + b * (sinTheta * sin(phi)) + axis * cosTheta);
+    light.dst = 99999999.f;
+    light.emission = vec3(sunStrength(light.dir));
+    light.light = LIGHT_ENVIRONMENT;
+    // samples below the horizon can't contribute, skip their shadow rays
+    light.pdf = light.emission.x > 0.f ? selectPMF * sunPDF(light.dir) : 0.f;
+    return light;
+}
+
+// the part of the environment sampleEnvironment covers, the rest of the sky is left to the bsdf rays
+vec3 environmentSampledRadiance(vec3 dir) {
+    if (environmentMapActive()) return environmentRadiance(dir);
+    if (sunActive()) return vec3(sunStrength(dir));
+    return vec3(0.f);
+}
+
+// solid angle pdf of sampleEnvironment, without the selection probability
+float environmentPDF(vec3 dir) {
+    if (environmentMapActive()) return environmentMapPDF(dir);
+    if (sunActive()) return sunPDF(dir);
+    return 0.f;
+}
+
+LightSample sampleEnvironment(vec2 u, float selectPMF) {
+    return environmentMapActive() ? sampleEnvironmentMap(u, selectPMF) : sampleSun(u, selectPMF);
+}
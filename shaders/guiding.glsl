@@ -0,0 +1,113 @@
+// path guiding, included by raytrace_common.glsl. a hash grid over the scene where every cell learns a histogram of the
+// radiance arriving from each direction, diffuseBRDF draws part of its samples from it. the megakernel trains the
+// cells and guide_update.comp turns what they collected into cdfs every few frames
+
+const uint GUIDE_CELLS = 16384;
+const uint GUIDE_BANDS = 8; // bins of dir.y
+const uint GUIDE_SLICES = 8; // bins of phi, bands * slices is an equal area split of the sphere
+const uint GUIDE_BINS = GUIDE_BANDS * GUIDE_SLICES;
+const uint GUIDE_PROBES = 8; // linear probing, a cell that finds no slot goes unguided
+const float GUIDE_FRACTION = 0.5f; // share of diffuse samples drawn from the guide, the rest stay cosine weighted
+const float GUIDE_FIXED_POINT = 256.f; // training sums are uint atomics
+const float GUIDE_MAX_WEIGHT = 64.f; // one firefly can't claim a cell or overflow its sums
+
+// VulkanEngine::guideBuffer, zeroed by the host whenever guiding is reset
+layout (std430, binding = 31) buffer GuideCache {
+    uint guideEnabled;
+    float guideCellSize;
+    uint guideCellsUsed;
+    uint guidePadding;
+    uint guideKeys[GUIDE_CELLS]; // 0 = empty slot
+    uint guideTraining[GUIDE_CELLS * GUIDE_BINS]; // radiance / pdf that landed in each bin since the last update
+    float guideCDF[GUIDE_CELLS * GUIDE_BINS]; // per cell, all 0 until the first update with training data
+};
+
+// grid cell of point, the dominant axis of the normal keeps the two sides of a thin wall apart
+uint guideKey(vec3 point, vec3 normal) {
+    ivec3 cell = ivec3(floor(point / guideCellSize));
+    vec3 axis = abs(normal);
+    uint dominant = axis.x > axis.y && axis.x > axis.z ? 0 : (axis.y > axis.z ? 1 : 2);
+    uint orientation = dominant * 2 + (normal[dominant] < 0.f ? 1 : 0);
+    uint key = hashCombine(hashCombine(hashCombine(hashUint(uint(cell.x)), uint(cell.y)), uint(cell.z)), orientation);
+    return max(key, 1u);
+}
+
+// slot of the cell around point if it has learned a distribution, -1 otherwise
+int guideFind(vec3 point, vec3 normal) {
+    if (guideEnabled == 0) return -1;
+    uint key = guideKey(point, normal);
+    for (uint i = 0; i < GUIDE_PROBES; i++) {
+        uint slot = (key + i) % GUIDE_CELLS;
+        uint stored = guideKeys[slot];
+        if (stored == key) return guideCDF[slot * GUIDE_BINS + GUIDE_BINS - 1] > 0.f ? int(slot) : -1;
+        if (stored == 0) return -1;
+    }
+    return -1;
+}
+
+// like guideFind, but claims an empty slot for a new cell and doesn't care whether it is trained yet
+int guideInsert(vec3 point, vec3 normal) {
+    uint key = guideKey(point, normal);
+    for (uint i = 0; i < GUIDE_PROBES; i++) {
+        uint slot = (key + i) % GUIDE_CELLS;
+        uint stored = guideKeys[slot];
+        if (stored == 0) {
+            stored = atomicCompSwap(guideKeys[slot], 0, key);
+            if (stored == 0) {
+                atomicAdd(guideCellsUsed, 1);
+                return int(slot);
+            }
+        }
+        if (stored == key) return int(slot);
+    }
+    return -1;
+}
+
+uint guideBin(vec3 dir) {
+    uint band = min(uint((dir.y + 1.f) * 0.5f * GUIDE_BANDS), GUIDE_BANDS - 1);
+    float phi = atan(dir.z, dir.x);
+    if (phi < 0.f) phi += 2.f * PI;
+    uint slice = min(uint(phi / (2.f * PI) * GUIDE_SLICES), GUIDE_SLICES - 1);
+    return band * GUIDE_SLICES + slice;
+}
+
+// solid angle pdf of dir in the cell's sphere distribution, every bin covers 4pi / GUIDE_BINS
+float guideBinPDF(int slot, vec3 dir) {
+    uint first = uint(slot) * GUIDE_BINS;
+    uint bin = guideBin(dir);
+    float pmf = guideCDF[first + bin] - (bin > 0 ? guideCDF[first + bin - 1] : 0.f);
+    return pmf * GUIDE_BINS * 0.25f * INV_PI;
+}
+
+// solid angle pdf of sampleGuide, a direction above the surface can also come from its mirror image below
+float guidePDF(int slot, vec3 normal, vec3 dir) {
+    if (dot(normal, dir) <= 0.f) return 0.f;
+    return guideBinPDF(slot, dir) + guideBinPDF(slot, reflect(dir, normal));
+}
+
+// bin from the cell's cdf, then a uniform direction inside it. the bins cover the whole sphere, so directions below
+// the surface are mirrored above it instead of being wasted on a sample the brdf gives nothing
+vec3 sampleGuide(int slot, vec3 normal, vec2 u) {
+    uint first = uint(slot) * GUIDE_BINS;
+    uint low = 0;
+    uint high = GUIDE_BINS - 1;
+    while (low < high) {
+        uint middle = (low + high) / 2;
+        if (guideCDF[first + middle] <= u.x) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    // where u landed inside the bin picks the band position, so both halves of u stay stratified
+    float below = low > 0 ? guideCDF[first + low - 1] : 0.f;
+    float pmf = guideCDF[first + low] - below;
+    float inBin = pmf > 0.f ? clamp((u.x - below) / pmf, 0.f, 1.f) : 0.5f;
+
+    float y = -1.f + 2.f * ((low / GUIDE_SLICES) + inBin) / GUIDE_BANDS;
+    float phi = 2.f * PI * ((low % GUIDE_SLICES) + u.y) / GUIDE_SLICES;
+    float r = sqrt(max(1.f - y * y, 0.f));
+    vec3 dir = vec3(r * cos(phi), y, r * sin(phi));
+    return dot(normal, dir) < 0.f ? reflect(dir, normal) : dir;
+}
@@ -0,0 +1,1124 @@
+// shared by the megakernel (raytrace.comp) and the wavefront stages (wavefront_*.comp)
+
+const float PI = 3.1415926535897932384f;
+const float INV_PI = 0.3183098862f;
+
+struct CameraInfo {
+    mat4 cameraRotation;
+    vec3 pos;
+    float nearPlane;
+    float aspectRatio;
+    float fov;
+};
+
+struct Ray {
+    vec3 origin;
+    vec3 dir;
+    vec3 invDir;
+    uvec3 dimSign;
+};
+
+//material
+struct Material {
+    vec3 albedo; //albedo.w = reflectance
+    vec3 emissionColor; //emissionColor.w = emissionStrength
+    float emissionStrength;
+	float reflectance;
+    float ior;
+    int albedoIndex;
+    int metalnessIndex;
+    int alphaIndex;
+    int bumpIndex;
+};
+
+//objects
+struct BoundingBox {
+    //[0] = min, [1] = max, only use 3 of the vec components bc memory alignment
+    vec4[2] bounds; 
+};
+
+#include "render_object.glsl"
+
+//shapes
+struct Sphere {
+    vec3 position;
+    float radius;
+    uint materialIndex;
+};
+
+struct Triangle {
+    uint v0;
+    uint v1;
+    uint v2;
+    uint frontOnly;
+    vec3 binormal;
+    vec3 tangent;
+};
+
+struct TrianglePoint {
+    vec4 position;
+    vec4 normal;
+};
+
+struct HitInfo {
+    vec3 hitPoint;
+    vec3 normal;
+    vec2 uv;
+    float dst;
+    uint objectHitIndex;
+    uint triHitIndex;
+    uint materialIndex;
+    bool didHit;
+    bool frontFace;
+};
+
+//bvh
+struct BVHNode {
+	vec2 boundsX, boundsY, boundsZ;
+	uint index, triCount;
+	//if triCount == 0: index is a node index, else: index is a triangle index
+};
+
+//push constants
+struct EnvironmentData {
+    vec4 horizonColor; //w = sun focus
+    vec4 zenithColor; //w = sun intensity
+    vec3 groundColor;
+    vec4 lightDir; //w = environment on
+};
+
+struct RayTracerData {
+    bool progressive;
+    bool singleRender;
+    int debugMode;
+    uint raysPerPixel;
+    uint bounceLimit;
+    uint sphereCount;
+    uint objectCount;
+    uint triCap;
+    uint boxCap;
+    uint sampleLimit;
+    bool persistentThreads;
+    uint lightCount;
+    bool lightTree; // pick lights by traversing lightNodes instead of the alias table
+    uint samplerType; // SAMPLER_PCG, SAMPLER_SOBOL or SAMPLER_BLUE_NOISE, see sampler.glsl
+    float adaptiveThreshold; // relative standard error below which a pixel stops sampling
+};
+
+struct BxDFResult {
+    vec3 sampledDir;
+    vec3 radiance;
+    float originSign;
+    float pdf; // pdf of sampledDir, 0 for delta lobes which MIS can't apply to
+};
+
+layout (binding = 0, rgba8) uniform image2D outImage;
+
+layout (binding = 1) uniform texture2D TextureBuffer[64];
+
+layout (std140, binding = 2) readonly buffer SphereBuffer {
+    Sphere spheres[];
+};
+
+layout (std140, binding = 3) readonly buffer MaterialBuffer {
+    Material materials[];
+};
+
+layout (std140, binding = 4) readonly buffer TrianglePositionBuffer {
+    TrianglePoint trianglePoints[];
+};
+
+layout (std140, binding = 5) readonly buffer TriangleBuffer {
+    Triangle triangles[];
+};
+
+layout (std140, binding = 6) readonly buffer ObjectBuffer {
+    RenderObject objects[];
+};
+
+layout (std140, binding = 7) readonly buffer BVHBuffer {
+    BVHNode bvhNodes[];
+};
+
+layout (binding = 8) uniform sampler TextureSampler[2];
+
+// intersection only triangles in bvh leaf order (same index as triangles[]), edges precomputed
+struct TriangleIntersect {
+    vec4 v0; // w = frontOnly
+    vec4 edge1; // v1 - v0
+    vec4 edge2; // v2 - v0
+};
+
+layout (std430, binding = 15) readonly buffer TriangleIntersectBuffer {
+    TriangleIntersect triangleIntersects[];
+};
+
+const uint LIGHT_TRIANGLE = 0; // emits from both faces
+const uint LIGHT_TRIANGLE_FRONT = 1;
+const uint LIGHT_SPHERE = 2; // v0 = center, edge1.x = radius
+
+// every emissive triangle and sphere in world space, in light tree leaf order. picked by the tree or
+// by power through the alias table, then a point is sampled uniformly by area
+struct LightSource {
+    vec3 v0;
+    float area;
+    vec3 edge1;
+    float selectPDF; // power / total power
+    vec3 edge2;
+    float aliasProbability; // keep this light below it, else take alias
+    vec3 emission;
+    uint alias;
+    vec3 normal;
+    uint shape; // LIGHT_*
+};
+
+layout (std430, binding = 22) readonly buffer LightBuffer {
+    LightSource lights[];
+};
+
+// binary tree over lights[] with one light per leaf, children are stored next to each other
+struct LightNode {
+    vec3 boundsMin;
+    float power;
+    vec3 boundsMax;
+    float cosTheta; // cone around axis bounding every emitting normal, -1 = emits everywhere
+    vec3 axis;
+    uint child;
+    uint first; // lights[] range under the node
+    uint count;
+};
+
+layout (std430, binding = 23) readonly buffer LightTreeBuffer {
+    LightNode lightNodes[];
+};
+
+// spheres first (by orderedSpheres index), then every triangle of each emissive object from its lightOffset
+layout (std430, binding = 24) readonly buffer LightSlotBuffer {
+    uint lightSlots[];
+};
+
+// adaptive sampling: progressive accumulation in floats, each pixel counting its own frames since converged ones stop
+layout (binding = 26, rgba32f) uniform image2D accumulation; // rgb = running mean, a = frames accumulated
+layout (binding = 27, r32f) uniform image2D luminanceM2; // welford sum of squared deviations of the frame luminances
+
+// pixels still above the error threshold, compacted by adaptive_compact.comp before the megakernel runs
+layout (std430, binding = 28) buffer AdaptiveQueue {
+    uvec3 activeGroups; // indirect dispatch args of the megakernel
+    uint activeCount;
+    uint activePixels[]; // row major pixel indices
+};
+
+// world space bvh over spheres[], which the host uploads in leaf order. root is node 0
+layout (std430, binding = 18) readonly buffer SphereBVHBuffer {
+    BVHNode sphereNodes[];
+};
+
+// which sample/bounce a wavefront dispatch is working on, unused by the megakernel
+struct WavefrontStep {
+    uint sampleIndex;
+    uint bounce;
+    uint pixelOffset;
+    bool sortPaths;
+};
+
+layout (push_constant) uniform constants {
+    CameraInfo camInfo;
+    EnvironmentData environment;
+    RayTracerData rayTracerParams;
+    uint frameCount;
+    WavefrontStep wavefront;
+    uvec2 tileOffset; // first pixel of a single render tile, 0 for full screen dispatches
+    uint primaryHitMode; // PRIMARY_HITS_* in raytrace.comp
+    bool adaptivePixels; // the megakernel only traces activePixels
+} PushConstants;
+
+// top bvh levels of every mesh, nodes are stored breadth first so they are the first nodes after the root.
+// sized by the host from maxComputeSharedMemorySize
+layout (constant_id = 0) const uint BVH_CACHE_NODES = 1;
+shared BVHNode bvhCache[BVH_CACHE_NODES];
+
+// megakernel variants are specialized per frame, the wavefront kernels keep these defaults
+layout (constant_id = 1) const bool HAS_SPHERES = true;
+layout (constant_id = 2) const bool DEBUG_STATS = true; // box/triangle counters for the debug views
+layout (constant_id = 3) const uint FIXED_BOUNCE_LIMIT = 0xffffffffu; // default = bounceLimit from the push constants
+
+// call at the very start of a kernel that traverses, before any invocation can return.
+// instances of the same mesh write the same nodes to the same slots
+void loadBVHCache() {
+#ifndef RAY_QUERY
+    uint groupSize = gl_WorkGroupSize.x * gl_WorkGroupSize.y * gl_WorkGroupSize.z;
+    for (uint i = 0; i < PushConstants.rayTracerParams.objectCount; i++) {
+        uint root = objects[i].bvhIndex;
+        uint offset = objects[i].cacheOffset;
+        uint count = objects[i].cacheCount;
+        for (uint j = gl_LocalInvocationIndex; j < count; j += groupSize) {
+            bvhCache[offset + j] = bvhNodes[root + j];
+        }
+    }
+    barrier();
+#endif
+}
+
+BVHNode fetchNode(RenderObject object, uint index) {
+    uint local = index - object.bvhIndex;
+    return local < object.cacheCount ? bvhCache[object.cacheOffset + local] : bvhNodes[index];
+}
+
+//https://www.shadertoy.com/view/4ssXzX
+float random(inout uint state) {
+    state = state * 747796405 + 2891336453;
+    uint result = ((state >> ((state >> 28) + 4)) ^ state) * 277803737;
+    result = (result >> 22) ^ result;
+    return result / 4294967295.f;
+}
+
+float randomNormal(inout uint state) {
+    float theta = 2 * 3.141592 * random(state);
+    float rho = sqrt(-2 * log(random(state)));
+    return rho * cos(theta);
+}
+
+vec3 randomDirection(inout uint state) {
+    vec3 randomDir = vec3(randomNormal(state), randomNormal(state), randomNormal(state));
+    randomDir = normalize(randomDir);
+    return randomDir;
+}
+
+#include "sampler.glsl"
+
+float schlick(float cosine, float refraction_index) {
+    float r0 = (1 - refraction_index) / (1 + refraction_index);
+    r0 = r0 * r0;
+    return r0 + (1 - r0) * pow((1 - cosine), 5);
+}
+
+Ray refraction(Ray ray, vec3 normal, float ior, inout uint state) {
+    float cosine = dot(-ray.dir, normal);
+    float sine =  sqrt(1 - cosine * cosine);
+    bool solution = (ior * sine) > 1.f || schlick(cosine, ior) > random(state);
+    vec3 dir = solution ? reflect(ray.dir, normal) : refract(ray.dir, normal, ior);
+    vec3 origin = ray.origin + normal * 0.0001 * (solution ? 1 : sign(dot(normal, ray.dir)));
+    Ray newRay;
+    newRay.dir = dir;
+    newRay.origin = origin;
+    return newRay;
+}
+
+HitInfo sphereIntersection(Sphere sphere, Ray ray) {
+    HitInfo hitInfo;
+    hitInfo.didHit = false;
+
+    vec3 oc = sphere.position - ray.origin;
+    float a = dot(ray.dir, ray.dir);
+    float b = dot(oc, ray.dir);
+    float c = dot(oc, oc) - sphere.radius * sphere.radius;
+    float discriminant = b * b - a * c;
+
+    if (discriminant >= 0) {
+        float sqrtd = sqrt(discriminant);
+        float dst = (b - sqrtd) / a;
+        hitInfo.frontFace = true;
+        if (dst < 0) {
+            dst = (b + sqrtd) / a;
+            hitInfo.frontFace = false;
+            if (dst < 0) {
+                return hitInfo;
+            }
+        }
+
+        hitInfo.didHit = true;
+        hitInfo.dst = dst;
+        hitInfo.hitPoint = ray.origin + ray.dir * dst;
+        hitInfo.normal = normalize(hitInfo.hitPoint - sphere.position) * (hitInfo.frontFace ? 1 : -1);
+        hitInfo.materialIndex = sphere.materialIndex;
+    }
+    return hitInfo;
+}
+
+//https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
+// t and barycentrics only, normals and uvs are resolved once traversal has found the closest hit
+bool triangleHit(Ray ray, TriangleIntersect tri, float tMax, out float dst, out vec2 bary) {
+    vec3 v0 = tri.v0.xyz;
+    vec3 v1v0 = tri.edge1.xyz;
+    vec3 v2v0 = tri.edge2.xyz;
+    bool frontOnly = tri.v0.w != 0.f;
+    vec3 rov0 = ray.origin - v0;
+    vec3 n = cross(v1v0, v2v0);
+
+    vec3 q = cross(rov0, ray.dir);
+    float d0 = -dot(ray.dir, n);
+    float d = 1.f / d0;
+
+    dst = dot(rov0, n) * d;
+    bary.x = dot(v2v0, q) * d;
+    bary.y = -dot(v1v0, q) * d;
+    bool frontFace = d0 >= 0.00000001f;
+    return dst >= 0 && dst < tMax && bary.x >= 0 && bary.y >= 0 && bary.x + bary.y <= 1 && !(!frontFace && frontOnly);
+}
+
+#ifdef RAY_QUERY
+layout (binding = 17) uniform accelerationStructureEXT topLevelAS;
+
+// only meshes with front only triangles are built non-opaque, their back faces are never committed
+bool rayQueryAccept(uint objectIndex, uint primitiveIndex, vec3 objectDir) {
+    TriangleIntersect tri = triangleIntersects[objects[objectIndex].triOffset + primitiveIndex];
+    return tri.v0.w == 0.f || -dot(objectDir, cross(tri.edge1.xyz, tri.edge2.xyz)) >= 0.00000001f;
+}
+#endif
+
+float boxIntersection(BoundingBox box, Ray ray) {
+    vec3 tMin = (box.bounds[0].xyz - ray.origin) * ray.invDir;
+    vec3 tMax = (box.bounds[1].xyz - ray.origin) * ray.invDir;
+    vec3 t1 = min(tMin, tMax);
+    vec3 t2 = max(tMin, tMax);
+    float tNear = max(max(t1.x, t1.y), t1.z);
+    float tFar = min(min(t2.x, t2.y), t2.z);
+
+    bool hit = tFar >= tNear && tFar > 0;
+    float dst = hit ? tNear > 0 ? tNear : 0 : 99999999;
+    return dst;
+}
+
+// closest hit found by traversal, everything else about it is filled in by resolveHit
+struct HitRecord {
+    float dst;
+    vec2 bary;
+    uint primIndex; // triangle, or sphere for SPHERE_HIT
+    uint objectIndex;
+};
+
+const uint NO_HIT = 0xffffffffu;
+const uint SPHERE_HIT = 0xfffffffeu;
+
+BoundingBox nodeBounds(BVHNode node) {
+    BoundingBox box;
+    box.bounds[0].xyz = vec3(node.boundsX[0], node.boundsY[0], node.boundsZ[0]);
+    box.bounds[1].xyz = vec3(node.boundsX[1], node.boundsY[1], node.boundsZ[1]);
+    return box;
+}
+
+void traceSpheres(Ray ray, inout HitRecord closest, inout float stats[4]) {
+    if (!HAS_SPHERES || PushConstants.rayTracerParams.sphereCount == 0) return;
+    ray.invDir = 1 / ray.dir;
+
+    uint stack[64];
+    uint stackIndex = 1;
+    stack[0] = 0;
+    while (stackIndex > 0) {
+        BVHNode currentNode = sphereNodes[stack[--stackIndex]];
+
+        if (currentNode.triCount != 0) {
+            for (uint i = currentNode.index; i < currentNode.index + currentNode.triCount; i++) {
+                HitInfo hitInfo = sphereIntersection(spheres[i], ray);
+                if (hitInfo.didHit && hitInfo.dst < closest.dst) {
+                    closest.dst = hitInfo.dst;
+                    closest.primIndex = i;
+                    closest.objectIndex = SPHERE_HIT;
+                }
+            }
+        } else {
+            float dst1 = boxIntersection(nodeBounds(sphereNodes[currentNode.index]), ray);
+            float dst2 = boxIntersection(nodeBounds(sphereNodes[currentNode.index + 1]), ray);
+            if (DEBUG_STATS) stats[0] += 2;
+
+            bool isNearestA = dst1 <= dst2;
+            if (max(dst1, dst2) < closest.dst) stack[stackIndex++] = isNearestA ? currentNode.index + 1 : currentNode.index;
+            if (min(dst1, dst2) < closest.dst) stack[stackIndex++] = isNearestA ? currentNode.index : currentNode.index + 1;
+        }
+    }
+}
+
+bool spheresOccluded(Ray ray, float tMax, inout float stats[4]) {
+    if (!HAS_SPHERES || PushConstants.rayTracerParams.sphereCount == 0) return false;
+    ray.invDir = 1 / ray.dir;
+
+    uint stack[64];
+    uint stackIndex = 1;
+    stack[0] = 0;
+    while (stackIndex > 0) {
+        BVHNode currentNode = sphereNodes[stack[--stackIndex]];
+
+        if (currentNode.triCount != 0) {
+            for (uint i = currentNode.index; i < currentNode.index + currentNode.triCount; i++) {
+                HitInfo hitInfo = sphereIntersection(spheres[i], ray);
+                if (hitInfo.didHit && hitInfo.dst < tMax) return true;
+            }
+        } else {
+            float dst1 = boxIntersection(nodeBounds(sphereNodes[currentNode.index]), ray);
+            float dst2 = boxIntersection(nodeBounds(sphereNodes[currentNode.index + 1]), ray);
+            if (DEBUG_STATS) stats[2] += 2;
+
+            bool isNearestA = dst1 <= dst2;
+            if (max(dst1, dst2) < tMax) stack[stackIndex++] = isNearestA ? currentNode.index + 1 : currentNode.index;
+            if (min(dst1, dst2) < tMax) stack[stackIndex++] = isNearestA ? currentNode.index : currentNode.index + 1;
+        }
+    }
+    return false;
+}
+
+// stats[0]/[1] count box/triangle tests of closest hit rays, [2]/[3] the same for shadow rays
+HitRecord traceClosest(Ray ray, inout float stats[4]) {
+    HitRecord closest;
+    closest.dst = 99999999;
+    closest.objectIndex = NO_HIT;
+    RayTracerData traceData = PushConstants.rayTracerParams;
+
+    traceSpheres(ray, closest, stats);
+
+#ifdef RAY_QUERY
+    // hardware traversal over every object at once, there are no box/triangle counts to report
+    rayQueryEXT rayQuery;
+    rayQueryInitializeEXT(rayQuery, topLevelAS, gl_RayFlagsNoneEXT, 0xFF, ray.origin, 0.f, ray.dir, closest.dst);
+    while (rayQueryProceedEXT(rayQuery)) {
+        uint objectIndex = uint(rayQueryGetIntersectionInstanceCustomIndexEXT(rayQuery, false));
+        uint primitiveIndex = uint(rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, false));
+        if (rayQueryAccept(objectIndex, primitiveIndex, rayQueryGetIntersectionObjectRayDirectionEXT(rayQuery, false))) {
+            rayQueryConfirmIntersectionEXT(rayQuery);
+        }
+    }
+
+    if (rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionTriangleEXT) {
+        uint objectIndex = uint(rayQueryGetIntersectionInstanceCustomIndexEXT(rayQuery, true));
+        closest.dst = rayQueryGetIntersectionTEXT(rayQuery, true);
+        closest.bary = rayQueryGetIntersectionBarycentricsEXT(rayQuery, true);
+        closest.primIndex = objects[objectIndex].triOffset + uint(rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, true));
+        closest.objectIndex = objectIndex;
+    }
+#else
+    for (int i = 0; i < traceData.objectCount; i++) {
+        RenderObject object = objects[i];
+        Ray transformRay;
+        transformRay.dir = (inverse(object.transformMatrix) * vec4(ray.dir, 0.f)).xyz;
+        transformRay.origin = (inverse(object.transformMatrix) * vec4(ray.origin, 1.f)).xyz;
+        transformRay.invDir = 1 / transformRay.dir;
+
+        for (int j = 0; j < 3; j++) {
+            transformRay.dimSign[j] = uint(transformRay.invDir[j] < 0);
+        }
+
+        //bvh traversal
+        uint stack[64];
+        uint stackIndex = 1;
+        stack[0] = object.bvhIndex;
+        while (stackIndex > 0) {
+            BVHNode currentNode = fetchNode(object, stack[--stackIndex]);
+
+            if (currentNode.triCount != 0) {
+                //check for triangles
+                if (DEBUG_STATS) stats[1] += currentNode.triCount;
+                for (uint j = currentNode.index; j < currentNode.index + currentNode.triCount; j++) {
+                    float dst;
+                    vec2 bary;
+                    if (triangleHit(transformRay, triangleIntersects[j], closest.dst, dst, bary)) {
+                        closest.dst = dst;
+                        closest.bary = bary;
+                        closest.primIndex = j;
+                        closest.objectIndex = i;
+                    }
+                }
+            } else {
+                //push nodes based on which one is closer
+                BVHNode child1 = fetchNode(object, currentNode.index);
+                BVHNode child2 = fetchNode(object, currentNode.index + 1);
+
+                BoundingBox box1;
+                box1.bounds[0].xyz = vec3(child1.boundsX[0], child1.boundsY[0], child1.boundsZ[0]);
+                box1.bounds[1].xyz = vec3(child1.boundsX[1], child1.boundsY[1], child1.boundsZ[1]);
+                BoundingBox box2;
+                box2.bounds[0].xyz = vec3(child2.boundsX[0], child2.boundsY[0], child2.boundsZ[0]);
+                box2.bounds[1].xyz = vec3(child2.boundsX[1], child2.boundsY[1], child2.boundsZ[1]);
+
+                float dst1 = boxIntersection(box1, transformRay);
+                float dst2 = boxIntersection(box2, transformRay);
+                if (DEBUG_STATS) stats[0] += 2;
+
+                bool isNearestA = dst1 <= dst2;
+                float dstNear = isNearestA ? dst1 : dst2;
+                float dstFar = isNearestA ? dst2 : dst1;
+                uint childIndexNear = isNearestA ? currentNode.index : currentNode.index + 1;
+                uint childIndexFar = isNearestA ? currentNode.index + 1 : currentNode.index;
+
+                if (dstFar < closest.dst) stack[stackIndex++] = childIndexFar;
+                if (dstNear < closest.dst) stack[stackIndex++] = childIndexNear;
+            }
+        }
+    }
+
+#endif
+    return closest;
+}
+
+// normals, uvs and the world space transform, only done once for the final hit
+HitInfo resolveHit(Ray ray, HitRecord record) {
+    HitInfo hit;
+    hit.didHit = false;
+    hit.dst = record.dst;
+    if (record.objectIndex == NO_HIT) return hit;
+    if (record.objectIndex == SPHERE_HIT) {
+        hit = sphereIntersection(spheres[record.primIndex], ray);
+        hit.objectHitIndex = SPHERE_HIT;
+        hit.triHitIndex = record.primIndex;
+        return hit;
+    }
+
+    RenderObject object = objects[record.objectIndex];
+    Triangle tri = triangles[record.primIndex];
+    TrianglePoint v0 = trianglePoints[tri.v0];
+    TrianglePoint v1 = trianglePoints[tri.v1];
+    TrianglePoint v2 = trianglePoints[tri.v2];
+
+    vec3 objectDir = (inverse(object.transformMatrix) * vec4(ray.dir, 0.f)).xyz;
+    TriangleIntersect edges = triangleIntersects[record.primIndex];
+    vec3 n = cross(edges.edge1.xyz, edges.edge2.xyz);
+    float u = record.bary.x;
+    float v = record.bary.y;
+    float w = 1.f - u - v;
+
+    hit.didHit = true;
+    hit.frontFace = -dot(objectDir, n) >= 0.00000001f;
+    hit.hitPoint = ray.origin + ray.dir * record.dst;
+
+    vec2 v0uv = vec2(v0.position.w, v0.normal.w);
+    vec2 v1uv = vec2(v1.position.w, v1.normal.w);
+    vec2 v2uv = vec2(v2.position.w, v2.normal.w);
+    hit.uv = w * v0uv + u * v1uv + v * v2uv;
+
+    if (v0uv == v1uv || v1uv == v2uv || v2uv == v0uv) {
+        hit.uv = vec2(0.5f);
+    }
+
+    vec3 normal = (w * v0.normal.xyz + u * v1.normal.xyz + v * v2.normal.xyz) * (hit.frontFace ? 1 : -1);
+    hit.normal = normalize((object.transformMatrix * vec4(normal, 0.f))).xyz;
+    hit.materialIndex = object.materialIndex;
+    hit.triHitIndex = record.primIndex;
+    hit.objectHitIndex = record.objectIndex;
+    return hit;
+}
+
+HitInfo calculateIntersections(Ray ray, inout float stats[4]) {
+    return resolveHit(ray, traceClosest(ray, stats));
+}
+
+// any-hit traversal for shadow rays, returns at the first blocker closer than tMax
+bool occluded(vec3 origin, vec3 dir, float tMax, inout float stats[4]) {
+    RayTracerData traceData = PushConstants.rayTracerParams;
+    Ray ray;
+    ray.origin = origin;
+    ray.dir = dir;
+
+    if (spheresOccluded(ray, tMax, stats)) return true;
+
+#ifdef RAY_QUERY
+    if (tMax <= 0.f) return false;
+    rayQueryEXT rayQuery;
+    rayQueryInitializeEXT(rayQuery, topLevelAS, gl_RayFlagsTerminateOnFirstHitEXT, 0xFF, origin, 0.f, dir, tMax);
+    while (rayQueryProceedEXT(rayQuery)) {
+        uint objectIndex = uint(rayQueryGetIntersectionInstanceCustomIndexEXT(rayQuery, false));
+        uint primitiveIndex = uint(rayQueryGetIntersectionPrimitiveIndexEXT(rayQuery, false));
+        if (rayQueryAccept(objectIndex, primitiveIndex, rayQueryGetIntersectionObjectRayDirectionEXT(rayQuery, false))) {
+            rayQueryConfirmIntersectionEXT(rayQuery);
+        }
+    }
+
+    return rayQueryGetIntersectionTypeEXT(rayQuery, true) != gl_RayQueryCommittedIntersectionNoneEXT;
+#else
+    for (int i = 0; i < traceData.objectCount; i++) {
+        RenderObject object = objects[i];
+        Ray transformRay;
+        transformRay.dir = (inverse(object.transformMatrix) * vec4(dir, 0.f)).xyz;
+        transformRay.origin = (inverse(object.transformMatrix) * vec4(origin, 1.f)).xyz;
+        transformRay.invDir = 1 / transformRay.dir;
+
+        uint stack[64];
+        uint stackIndex = 1;
+        stack[0] = object.bvhIndex;
+        while (stackIndex > 0) {
+            BVHNode currentNode = fetchNode(object, stack[--stackIndex]);
+
+            if (currentNode.triCount != 0) {
+                if (DEBUG_STATS) stats[3] += currentNode.triCount;
+                for (uint j = currentNode.index; j < currentNode.index + currentNode.triCount; j++) {
+                    float dst;
+                    vec2 bary;
+                    if (triangleHit(transformRay, triangleIntersects[j], tMax, dst, bary)) return true;
+                }
+            } else {
+                BVHNode child1 = fetchNode(object, currentNode.index);
+                BVHNode child2 = fetchNode(object, currentNode.index + 1);
+
+                BoundingBox box1;
+                box1.bounds[0].xyz = vec3(child1.boundsX[0], child1.boundsY[0], child1.boundsZ[0]);
+                box1.bounds[1].xyz = vec3(child1.boundsX[1], child1.boundsY[1], child1.boundsZ[1]);
+                BoundingBox box2;
+                box2.bounds[0].xyz = vec3(child2.boundsX[0], child2.boundsY[0], child2.boundsZ[0]);
+                box2.bounds[1].xyz = vec3(child2.boundsX[1], child2.boundsY[1], child2.boundsZ[1]);
+
+                float dst1 = boxIntersection(box1, transformRay);
+                float dst2 = boxIntersection(box2, transformRay);
+                if (DEBUG_STATS) stats[2] += 2;
+
+                // near child on top so a blocker is likely found sooner
+                bool isNearestA = dst1 <= dst2;
+                if (max(dst1, dst2) < tMax) stack[stackIndex++] = isNearestA ? currentNode.index + 1 : currentNode.index;
+                if (min(dst1, dst2) < tMax) stack[stackIndex++] = isNearestA ? currentNode.index : currentNode.index + 1;
+            }
+        }
+    }
+
+#endif
+    return false;
+}
+
+const uint LIGHT_ENVIRONMENT = 0xfffffffeu; // LightSample.light of the environment map or sun
+const uint LIGHT_NONE = 0xffffffffu;
+
+struct LightSample {
+    vec3 dir;
+    float dst;
+    vec3 emission;
+    float pdf; // solid angle, 0 when nothing can be connected to
+    uint light; // lights index, LIGHT_ENVIRONMENT or LIGHT_NONE
+};
+
+#include "environment.glsl"
+#include "guiding.glsl"
+
+//from sebastian lague
+vec3 getEnvironmentLight(Ray ray) {
+    if (environmentMapActive()) return environmentRadiance(ray.dir);
+    EnvironmentData env = PushConstants.environment;
+    float skyGradientT = pow(smoothstep(0, 0.4, -ray.dir.y), 0.35);
+    vec3 skyGradient = mix(env.horizonColor.xyz, env.zenithColor.xyz, skyGradientT);
+    float groundToSkyT = smoothstep(-0.01, 0, -ray.dir.y);
+    return env.lightDir.w == 1 ? mix(env.groundColor, skyGradient, groundToSkyT) + sunStrength(ray.dir) : vec3(0.f);
+}
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// conservative estimate of how much a node can contribute to point: power over distance squared,
+// with the cosine of the smallest angle any of its emitters can make towards the point
+float lightNodeImportance(LightNode node, vec3 point) {
+    vec3 center = (node.boundsMin + node.boundsMax) * 0.5f;
+    vec3 toPoint = point - center;
+    float dst2 = dot(toPoint, toPoint);
+    float radius2 = dot(node.boundsMax - center, node.boundsMax - center);
+
+    // inside the bounds every emitter could face the point
+    if (dst2 <= radius2) return node.power / max(radius2, 0.00000001f);
+    if (node.cosTheta <= -1.f) return node.power / dst2;
+
+    float theta = acos(clamp(dot(node.axis, toPoint) / sqrt(dst2), -1.f, 1.f));
+    float thetaBounds = asin(sqrt(radius2 / dst2));
+    float thetaPrime = max(theta - acos(node.cosTheta) - thetaBounds, 0.f);
+    return thetaPrime >= PI * 0.5f ? 0.f : node.power * cos(thetaPrime) / dst2;
+}
+
+// probability of descending into node.child instead of node.child + 1
+float lightChildProbability(LightNode node, vec3 point) {
+    LightNode left = lightNodes[node.child];
+    LightNode right = lightNodes[node.child + 1];
+    float importanceLeft = lightNodeImportance(left, point);
+    float importanceRight = lightNodeImportance(right, point);
+    if (importanceLeft + importanceRight <= 0.f) {
+        importanceLeft = left.power;
+        importanceRight = right.power;
+    }
+    return importanceLeft / (importanceLeft + importanceRight);
+}
+
+// stochastic traversal of a single sample, rescaled at every level so the whole descent stays stratified
+uint pickLight(vec3 point, float u, out float pmf) {
+    pmf = 1.f;
+    LightNode node = lightNodes[0];
+    while (node.count > 1) {
+        float probability = lightChildProbability(node, point);
+        bool left = u < probability;
+        u = left ? u / probability : (u - probability) / (1.f - probability);
+        u = min(u, 0.99999994f);
+        pmf *= left ? probability : 1.f - probability;
+        node = lightNodes[left ? node.child : node.child + 1];
+    }
+    return node.first;
+}
+
+// replays pickLight towards a known light, the pmf of a light the bsdf found
+float lightTreePMF(vec3 point, uint slot) {
+    float pmf = 1.f;
+    LightNode node = lightNodes[0];
+    while (node.count > 1) {
+        float probability = lightChildProbability(node, point);
+        LightNode left = lightNodes[node.child];
+        bool inLeft = slot < left.first + left.count;
+        pmf *= inLeft ? probability : 1.f - probability;
+        node = inLeft ? left : lightNodes[node.child + 1];
+    }
+    return pmf;
+}
+
+float lightSelectPMF(vec3 point, uint slot) {
+    return PushConstants.rayTracerParams.lightTree ? lightTreePMF(point, slot) : lights[slot].selectPDF;
+}
+
+// picks the environment map or sun, or a light for treePoint (the origin a bsdf ray from this hit would have), then a point on it
+LightSample sampleLight(vec3 origin, vec3 treePoint, inout uint state) {
+    LightSample light;
+    light.dir = vec3(0.f, 1.f, 0.f);
+    light.dst = 0.f;
+    light.emission = vec3(0.f);
+    light.pdf = 0.f;
+    light.light = LIGHT_NONE;
+    uint count = PushConstants.rayTracerParams.lightCount;
+
+    // the environment map takes the front of the pick range, the emitters share the rest
+    float pick = sampleDimension(DIMENSION_LIGHT_PICK, state);
+    vec2 u = sampleDimension2D(DIMENSION_LIGHT_POINT, state);
+    float environmentPMF = environmentSelectPMF();
+    if (pick < environmentPMF) return sampleEnvironment(u, environmentPMF);
+    if (count == 0) return light;
+    pick = min((pick - environmentPMF) / (1.f - environmentPMF), 0.99999994f);
+
+    uint index;
+    float pmf;
+    if (PushConstants.rayTracerParams.lightTree) {
+        index = pickLight(treePoint, pick, pmf);
+    } else {
+        // the integer part picks the column, the fraction flips the alias coin
+        float column = pick * count;
+        index = min(uint(column), count - 1);
+        if (fract(column) >= lights[index].aliasProbability) index = lights[index].alias;
+        pmf = lights[index].selectPDF;
+    }
+    pmf *= 1.f - environmentPMF;
+    LightSource source = lights[index];
+
+    vec3 point;
+    vec3 normal;
+    if (source.shape == LIGHT_SPHERE) {
+        float z = 1.f - 2.f * u.x;
+        float r = sqrt(max(1.f - z * z, 0.f));
+        float phi = 2.f * PI * u.y;
+        normal = vec3(r * cos(phi), r * sin(phi), z);
+        point = source.v0 + normal * source.edge1.x;
+    } else {
+        float su = sqrt(u.x);
+        float v = u.y;
+        point = source.v0 + source.edge1 * (su * (1.f - v)) + source.edge2 * (su * v);
+        normal = source.normal;
+    }
+    vec3 toLight = point - origin;
+    light.dst = length(toLight);
+    light.dir = toLight / light.dst;
+
+    // one sided lights only emit towards their front face, the far side of a sphere is hidden by itself
+    float cosLight = dot(normal, -light.dir);
+    if ((source.shape != LIGHT_TRIANGLE && cosLight <= 0.f) || cosLight == 0.f) return light;
+
+    light.emission = source.emission;
+    light.pdf = pmf / source.area * light.dst * light.dst / abs(cosLight);
+    light.light = index;
+    return light;
+}
+
+// solid angle pdf sampleLight would have had for a hit the bsdf ray found
+float lightHitPDF(HitInfo hit, Ray ray) {
+    RayTracerData traceData = PushConstants.rayTracerParams;
+    if (!hit.didHit || traceData.lightCount == 0) return 0.f;
+    Material hitMaterial = materials[hit.materialIndex];
+    if (hitMaterial.emissionStrength <= 0.f) return 0.f;
+
+    uint key = hit.triHitIndex;
+    if (hit.objectHitIndex != SPHERE_HIT) {
+        RenderObject object = objects[hit.objectHitIndex];
+        key = object.lightOffset + hit.triHitIndex - object.triOffset;
+    }
+    uint slot = lightSlots[key];
+    if (slot == 0xffffffffu) return 0.f;
+
+    LightSource source = lights[slot];
+    vec3 normal = source.shape == LIGHT_SPHERE ? normalize(hit.hitPoint - source.v0) : source.normal;
+    float pmf = lightSelectPMF(ray.origin, slot) * (1.f - environmentSelectPMF());
+    return pmf / source.area * hit.dst * hit.dst / abs(dot(normal, ray.dir));
+}
+
+vec3 cosineHemisphereDir(vec3 rayNormal, inout uint state) {
+    vec2 u = sampleDimension2D(DIMENSION_BSDF, state);
+    float r1 = u.x;
+    float r2 = u.y;
+
+    // found by untegrating the pdf 2pi cos(theta)/pi sin(theta) dtheta
+    float phi = 2 * PI * r1;
+    float sqrtR2 = sqrt(r2);
+    float x = cos(phi) * sqrtR2;
+    float y = sin(phi) * sqrtR2;
+    float z = sqrt(1 - r2);
+
+    // generate orthonormal basis based on normal
+    vec3 zAlignedDir = vec3(x, y, z);
+    vec3 nonParallelAxis = abs(dot(rayNormal, vec3(1.f, 0.f, 0.f))) < 1.f ? vec3(1.f, 0.f, 0.f) : vec3(0.f, 0.f, 1.f);
+    vec3 t = normalize(cross(rayNormal, nonParallelAxis));
+    vec3 b = cross(rayNormal, t);
+    mat3 changeOfBasis = {t, b, rayNormal};
+
+    return changeOfBasis * zAlignedDir;
+}
+
+float cosineHemispherePDF(vec3 rayNormal, vec3 direction) {
+    return max(0, dot(direction, rayNormal) * INV_PI);
+}
+
+#include "restir.glsl"
+#include "restir_gi.glsl"
+
+// next event estimation ray, the light side of the estimate is only known once it has been traced
+struct ShadowRay {
+    vec3 origin;
+    vec3 dir;
+    float tMax; // distance to the sampled point on the light
+    vec3 brdf; // brdf * cosine, shadeHit folds in the path throughput
+    float bsdfPDF;
+    vec3 emission; // of the sampled light
+    float lightPDF; // solid angle pdf of dir from sampleLight
+    bool pending;
+};
+
+// cosine lobe, mixed with the guide when the cell around the hit has learned one
+float diffusePDF(int guideSlot, vec3 normal, vec3 dir) {
+    float cosinePDF = cosineHemispherePDF(normal, dir);
+    return guideSlot < 0 ? cosinePDF : mix(cosinePDF, guidePDF(guideSlot, normal, dir), GUIDE_FRACTION);
+}
+
+BxDFResult diffuseBRDF(vec3 incomingDir, HitInfo prevHit, inout uint state, out ShadowRay shadow) {
+    Material hitMaterial = materials[prevHit.materialIndex];
+    vec3 origin = prevHit.hitPoint + prevHit.normal * 0.01f;
+    int guideSlot = guideFind(prevHit.hitPoint, prevHit.normal);
+
+    // take samples account to PDFs. a resampled light already carries its weight, it doesn't take part in MIS, and neither
+    // does any light while restir gi reuses the bsdf ray
+    LightSample lightSample = primaryResampled ? resampledLightSample(primaryReservoir, origin) : sampleLight(origin, prevHit.hitPoint + prevHit.normal * 0.00001f, state);
+    vec3 sampledDir;
+    if (guideSlot >= 0 && sampleDimension(DIMENSION_BSDF_LOBE, state) < GUIDE_FRACTION) {
+        sampledDir = sampleGuide(guideSlot, prevHit.normal, sampleDimension2D(DIMENSION_BSDF, state));
+    } else {
+        sampledDir = cosineHemisphereDir(prevHit.normal, state);
+    }
+
+    // next event estimation, traced by connectShadowRay
+    shadow.origin = origin;
+    shadow.dir = lightSample.dir;
+    shadow.tMax = lightSample.dst;
+    shadow.brdf = hitMaterial.albedo * INV_PI * max(0.f, dot(prevHit.normal, lightSample.dir));
+    shadow.bsdfPDF = primaryResampled || primaryIndirect ? 0.f : diffusePDF(guideSlot, prevHit.normal, lightSample.dir);
+    shadow.emission = lightSample.emission;
+    shadow.lightPDF = lightSample.pdf;
+    shadow.pending = lightSample.pdf > 0.f;
+
+    // the MIS weight needs the light pdf of wherever this lands, shadeHit gets it from the next hit.
+    // both strategies stay above the surface, so the pdf is only 0 for a grazing sample
+    float pdf = diffusePDF(guideSlot, prevHit.normal, sampledDir);
+    vec3 radiance = pdf > 0.f ? hitMaterial.albedo * INV_PI * max(0.f, dot(prevHit.normal, sampledDir)) / pdf : vec3(0.f);
+
+    BxDFResult result = {sampledDir, radiance, 1.f, pdf};
+    return result;
+}
+
+vec3 connectShadowRay(ShadowRay shadow, inout float stats[4]) {
+    // tMax stops short of the light so it doesnt occlude itself
+    if (shadow.lightPDF <= 0.f) return vec3(0.f);
+    if (occluded(shadow.origin, shadow.dir, shadow.tMax - 0.001f, stats)) return vec3(0.f);
+
+    // light MIS weight
+    float realLightPDF = shadow.lightPDF;
+    float cosinePDF = shadow.bsdfPDF;
+    float misWeight1 = realLightPDF * realLightPDF / (realLightPDF * realLightPDF + cosinePDF * cosinePDF);
+    if (isnan(misWeight1)) misWeight1 = 0;
+
+    vec3 directLight = shadow.emission;
+    directLight *= shadow.brdf * (realLightPDF == 0 ? 0 : misWeight1 / realLightPDF);
+    return directLight;
+}
+
+BxDFResult specularBRDF(vec3 incomingDir, HitInfo prevHit, inout uint    state) {
+    BxDFResult result = {reflect(incomingDir, prevHit.normal), vec3(1.f), 1.f, 0.f};
+    return result;
+}
+
+BxDFResult dielectricBTDF(vec3 incomingDir, HitInfo prevHit, inout uint state) {
+    Material hitMaterial = materials[prevHit.materialIndex];
+    float ior = !prevHit.frontFace ? hitMaterial.ior : 1.f / hitMaterial.ior;
+
+    float cosine = dot(-incomingDir, prevHit.normal);
+    float sine =  sqrt(1 - cosine * cosine);
+    bool solution = (ior * sine) > 1.f || schlick(cosine, ior) > sampleDimension(DIMENSION_BSDF_LOBE, state);
+    vec3 dir = solution ? reflect(incomingDir, prevHit.normal) : refract(incomingDir, prevHit.normal, ior);
+    BxDFResult result = {dir, vec3(1.f), (solution ? 1 : sign(dot(prevHit.normal, incomingDir))), 0.f};
+    return result;
+}
+
+struct PathState {
+    Ray ray;
+    vec3 totalColor;
+    vec3 attenuation;
+    vec3 directLight; // previous bounce's shadow ray result, already weighted by the path throughput
+    float bsdfPDF; // pdf of the direction that led to this bounce, 0 from the camera or a delta lobe
+    uint bounce;
+    bool directResampled; // the previous bounce's shadow ray carried all of its direct light (restir), lights this ray finds are already counted
+};
+
+PathState startPath(Ray ray) {
+    PathState path;
+    path.ray = ray;
+    path.totalColor = vec3(0.f);
+    path.attenuation = vec3(1.f);
+    path.directLight = vec3(0.f);
+    path.bsdfPDF = 0.f;
+    path.bounce = 0;
+    path.directResampled = false;
+    return path;
+}
+
+// shading half of a bounce, returns false once the path has terminated. diffuse hits leave a pending
+// shadow ray whose connectShadowRay result has to land in path.directLight before the next bounce
+bool shadeHit(inout PathState path, HitInfo hit, inout uint state, out ShadowRay shadow) {
+    RayTracerData traceData = PushConstants.rayTracerParams;
+    uint j = path.bounce;
+    shadow.pending = false;
+    beginBounce(j);
+
+    // the light sampled at the previous bounce counts whether or not this ray hits anything
+    path.totalColor += path.directLight;
+    path.directLight = vec3(0.f);
+
+    // cosine MIS weights, the light pdf comes from where the bsdf ray landed instead of re-tracing the sampled direction
+    if (!hit.didHit) {
+        vec3 environment = getEnvironmentLight(path.ray);
+        if (path.directResampled) {
+            environment -= environmentSampledRadiance(path.ray.dir);
+        } else if (path.bsdfPDF > 0.f) {
+            // only the part sampleLight can also reach is shared with the shadow rays
+            float lightPDF = environmentSelectPMF() * environmentPDF(path.ray.dir);
+            float misWeight = path.bsdfPDF * path.bsdfPDF / (lightPDF * lightPDF + path.bsdfPDF * path.bsdfPDF);
+            environment -= environmentSampledRadiance(path.ray.dir) * (1.f - misWeight);
+        }
+        path.totalColor += path.attenuation * environment;
+        return false;
+    }
+
+    Material hitMaterial = materials[hit.materialIndex];
+
+    float misWeight = 1.f;
+    if (path.directResampled) {
+        misWeight = 0.f;
+    } else if (path.bsdfPDF > 0.f) {
+        float lightPDF = lightHitPDF(hit, path.ray);
+        misWeight = path.bsdfPDF * path.bsdfPDF / (lightPDF * lightPDF + path.bsdfPDF * path.bsdfPDF);
+        if (isnan(misWeight)) misWeight = 0;
+    }
+
+    path.totalColor += hitMaterial.emissionColor * hitMaterial.emissionStrength * misWeight * path.attenuation;
+    if (any(isnan(path.totalColor)) || path.totalColor.r < 0 || path.totalColor.g < 0 || path.totalColor.b < 0) {
+        path.totalColor = vec3(0.f);
+        return false;
+    }
+
+    // BxDF
+    BxDFResult bxdf;
+    if (hitMaterial.reflectance != 0) {
+        bxdf = specularBRDF(path.ray.dir, hit, state);
+    } else if (hitMaterial.ior != -1) {
+        bxdf = dielectricBTDF(path.ray.dir, hit, state);
+    } else {
+        bxdf = diffuseBRDF(path.ray.dir, hit, state, shadow);
+    }
+    vec3 throughput = path.attenuation;
+    path.attenuation *= bxdf.radiance;
+
+    // russian roulette
+    float rrProb = max(max(path.attenuation.r, path.attenuation.g), path.attenuation.b);
+    rrProb = min(rrProb, 0.95f); // clamp so mirrors dont bounce forever
+    rrProb = j <= 5 ? 1.f : rrProb; // keep prob at 1 for first 5 bounces to insure good coverage
+    if (sampleDimension(DIMENSION_ROULETTE, state) > rrProb) return false;
+    path.attenuation *= 1.f / rrProb;
+
+    // the shadow ray only gets traced if the path survives, so it is weighted like the continuation
+    if (shadow.pending) shadow.brdf *= throughput / rrProb;
+
+    // prep new bounce
+    path.bsdfPDF = bxdf.pdf;
+    path.directResampled = (primaryResampled || primaryIndirect) && bxdf.pdf > 0.f;
+    path.ray.origin = hit.hitPoint + hit.normal * bxdf.originSign * 0.00001f;
+    path.ray.dir = bxdf.sampledDir;
+    path.bounce++;
+    return path.bounce <= (FIXED_BOUNCE_LIMIT != 0xffffffffu ? FIXED_BOUNCE_LIMIT : traceData.bounceLimit);
+}
+
+Ray cameraRay(CameraInfo cam, ivec2 pixel, ivec2 dim) {
+    vec2 uv = vec2(pixel) / dim;
+
+    //from sebastian lague
+    float planeHeight = cam.nearPlane * tan(radians(cam.fov * 0.5f)) * 2.f;
+    float planeWidth = planeHeight * cam.aspectRatio;
+
+    vec3 bottomLeft = vec3(-planeWidth / 2.f, -planeHeight / 2.f, 0.1f);
+    vec3 point = bottomLeft + vec3(planeWidth * uv.x, planeHeight * uv.y, 0.f);
+    vec3 dir = normalize(point); 
+
+    Ray ray;
+    ray.dir = (cam.cameraRotation * vec4(dir, 1.f)).xyz;
+    ray.origin = cam.pos;
+    ray.invDir = 1.f / ray.dir;
+    for (int i = 0; i < 3; i++) {
+        ray.dimSign[i] = uint(ray.invDir[i] < 0);
+    }
+    return ray;
+}
+
+Ray cameraRay(ivec2 pixel, ivec2 dim) {
+    return cameraRay(PushConstants.camInfo, pixel, dim);
+}
+
+uint pixelSeed(ivec2 pixel, ivec2 dim) {
+    uint lol = PushConstants.frameCount;
+    uint startingSeed = uint(random(lol) * 23892183);
+    return pixel.y * dim.x + pixel.x + startingSeed;
+}
+
+void storePixel(ivec2 pixel, vec3 outColor, float stats[4]) {
+    RayTracerData traceData = PushConstants.rayTracerParams;
+    bool valid = !any(isnan(outColor)) && !any(isinf(outColor));
+
+    // a broken frame is shown but never accumulated, it would stick in the float mean
+    vec3 finalColor = outColor;
+    if (traceData.progressive && valid) {
+        vec4 accumulated = imageLoad(accumulation, pixel);
+        float frames = PushConstants.frameCount == 0 ? 0.f : accumulated.a;
+        float m2 = frames == 0.f ? 0.f : imageLoad(luminanceM2, pixel).r;
+        finalColor = frames == 0.f ? outColor : accumulated.rgb + (outColor - accumulated.rgb) / (frames + 1.f);
+
+        float frameLuminance = luminance(outColor);
+        m2 += (frameLuminance - luminance(accumulated.rgb)) * (frameLuminance - luminance(finalColor));
+        imageStore(accumulation, pixel, vec4(finalColor, frames + 1.f));
+        imageStore(luminanceM2, pixel, vec4(m2));
+    }
+    if (!valid) finalColor = vec3(1.f, 0.f, 1.f);
+
+    // production variants never collected the counters
+    if (DEBUG_STATS) {
+        if (traceData.debugMode == 0) {
+            finalColor = stats[0] > traceData.boxCap ? vec3(1.f, 0.f, 0.f) : vec3(stats[0]) / traceData.boxCap;
+        } else if (traceData.debugMode == 1) {
+            finalColor = stats[1] > traceData.triCap ? vec3(1.f, 0.f, 0.f) : vec3(stats[1]) / traceData.triCap;
+        } else if (traceData.debugMode == 2) {
+            finalColor.r = stats[0] / traceData.boxCap;
+            finalColor.g = 0.f;
+            finalColor.b = stats[1] / traceData.triCap;
+        } else if (traceData.debugMode == 3) {
+            finalColor = stats[2] > traceData.boxCap ? vec3(1.f, 0.f, 0.f) : vec3(stats[2]) / traceData.boxCap;
+        } else if (traceData.debugMode == 4) {
+            finalColor = stats[3] > traceData.triCap ? vec3(1.f, 0.f, 0.f) : vec3(stats[3]) / traceData.triCap;
+        }
+    }
+
+    imageStore(outImage, pixel, vec4(finalColor, 1.f));
+}
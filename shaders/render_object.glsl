@@ -0,0 +1,14 @@
+// VulkanEngine's RenderObject as the shaders see it, included by raytrace_common.glsl and visibility.vert so both
+// read the object buffer with the same layout
+
+struct RenderObject {
+    mat4 transformMatrix;
+    uint smoothShade; //0 = off, 1 = on (bool weird on glsl)
+    uint bvhIndex;
+    uint materialIndex;
+    uint samplerIndex;
+    uint triOffset; // first triangle of the mesh, ray query primitive indices are relative to it
+    uint cacheOffset; // where the mesh's top bvh levels start in bvhCache
+    uint cacheCount; // 0 = not cached
+    uint lightOffset; // lightSlots entry of the mesh's first triangle, if the material emits
+};
@@ -0,0 +1,123 @@
+// reservoir based spatiotemporal importance resampling of the primary hits' direct light (bitterli 2020), included by
+// raytrace_common.glsl. restir.comp fills a reservoir per pixel before the megakernel, which then shades its primary
+// diffuse hits with that reservoir's light instead of a fresh sampleLight
+
+const uint RESTIR_CANDIDATES = 8; // sampleLight calls per pixel and frame
+const float RESTIR_HISTORY_LIMIT = 20.f; // the previous frame counts for at most this many times the new candidates
+const uint RESTIR_SPATIAL_SAMPLES = 4;
+const float RESTIR_SPATIAL_RADIUS = 16.f; // pixels
+const uint TEMPORAL_RESERVOIRS = 2; // restir.comp's first pass writes here, the two final halves come before it
+const float RESTIR_NORMAL_THRESHOLD = 0.9f; // cosine between the normals of surfaces that may share reservoirs
+const float RESTIR_DEPTH_THRESHOLD = 0.1f; // relative depth difference between them
+
+struct Reservoir {
+    vec3 lightPoint; // point on the light, the direction for the environment
+    uint light; // lights index, LIGHT_ENVIRONMENT or LIGHT_NONE
+    float W; // unbiased contribution weight of the sample
+    float M; // candidates it has seen
+    uint normal; // octahedral normal of the surface the reservoir was built for
+    float depth; // that surface's distance from the camera, negative when the pixel has no diffuse hit
+};
+
+// VulkanEngine::reservoirBuffer, the header is written by the host every frame
+layout (std430, binding = 32) buffer Reservoirs {
+    CameraInfo previousCamera; // what the previous frame's reservoirs were built with
+    uint restirFrame; // picks the final half that is written this frame
+    uint restirHistory; // 0 when the previous frame's reservoirs can't be reused
+    uint restirEnabled; // the megakernel reads the reservoirs this frame
+    uint restirSpatial;
+    Reservoir reservoirs[]; // the final reservoirs of two frames, then the temporal pass output, one per pixel each
+};
+
+// set by the megakernel around its primary bounce
+bool primaryResampled = false;
+Reservoir primaryReservoir;
+
+uint packNormal(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = (1.f - abs(n.yx)) * vec2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+    return packSnorm2x16(n.z >= 0.f ? n.xy : folded);
+}
+
+vec3 unpackNormal(uint encoded) {
+    vec2 e = unpackSnorm2x16(encoded);
+    vec3 n = vec3(e, 1.f - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return normalize(n);
+}
+
+uint reservoirIndex(uint part, ivec2 pixel) {
+    ivec2 dim = imageSize(outImage);
+    return part * uint(dim.x * dim.y) + uint(pixel.y * dim.x + pixel.x);
+}
+
+// whether a reservoir stored for the surface with normal and depth can be reused for another one
+bool similarSurface(uint storedNormal, float storedDepth, vec3 normal, float depth) {
+    return storedDepth > 0.f
+        && dot(unpackNormal(storedNormal), normal) > RESTIR_NORMAL_THRESHOLD
+        && abs(storedDepth - depth) < RESTIR_DEPTH_THRESHOLD * depth;
+}
+
+// inverse of cameraRay, the pixel of cam whose ray passes through point
+bool reprojectPixel(CameraInfo cam, vec3 point, ivec2 dim, out ivec2 pixel) {
+    pixel = ivec2(-1);
+    vec3 local = transpose(mat3(cam.cameraRotation)) * (point - cam.pos);
+    if (local.z <= 0.f) return false;
+
+    float planeHeight = cam.nearPlane * tan(radians(cam.fov * 0.5f)) * 2.f;
+    float planeWidth = planeHeight * cam.aspectRatio;
+    vec2 planePoint = local.xy * (0.1f / local.z);
+    vec2 uv = (planePoint + vec2(planeWidth, planeHeight) * 0.5f) / vec2(planeWidth, planeHeight);
+    pixel = ivec2(round(uv * dim));
+    return all(greaterThanEqual(pixel, ivec2(0))) && all(lessThan(pixel, dim));
+}
+
+uint currentReservoirs() {
+    return restirFrame & 1;
+}
+
+uint previousReservoirs() {
+    return (restirFrame + 1) & 1;
+}
+
+// what the stored sample sends towards point. emitters are in area measure, so the geometry term is included
+vec3 reservoirRadiance(uint light, vec3 lightPoint, vec3 point, out vec3 dir, out float dst) {
+    dir = vec3(0.f, 1.f, 0.f);
+    dst = 0.f;
+    if (light == LIGHT_NONE) return vec3(0.f);
+    if (light == LIGHT_ENVIRONMENT) {
+        dir = lightPoint;
+        dst = 99999999.f;
+        return environmentSampledRadiance(dir);
+    }
+    // the light list may have been rebuilt since the sample was taken
+    if (light >= PushConstants.rayTracerParams.lightCount) return vec3(0.f);
+
+    vec3 toLight = lightPoint - point;
+    dst = length(toLight);
+    dir = toLight / dst;
+    LightSource source = lights[light];
+    vec3 normal = source.shape == LIGHT_SPHERE ? normalize(lightPoint - source.v0) : source.normal;
+    float cosLight = dot(normal, -dir);
+    if ((source.shape != LIGHT_TRIANGLE && cosLight <= 0.f) || cosLight == 0.f) return vec3(0.f);
+    return source.emission * abs(cosLight) / (dst * dst);
+}
+
+// unshadowed lambertian contribution, without the albedo and 1 / pi every sample at the surface shares
+float reservoirTarget(Reservoir r, vec3 point, vec3 normal) {
+    vec3 dir;
+    float dst;
+    vec3 radiance = reservoirRadiance(r.light, r.lightPoint, point, dir, dst);
+    return luminance(radiance) * max(0.f, dot(normal, dir));
+}
+
+// the megakernel's light sample for a primary hit, pdf is 1 / W so connectShadowRay weights it like any other
+LightSample resampledLightSample(Reservoir r, vec3 origin) {
+    LightSample light;
+    light.emission = reservoirRadiance(r.light, r.lightPoint, origin, light.dir, light.dst);
+    light.pdf = r.W > 0.f ? 1.f / r.W : 0.f;
+    light.light = r.light;
+    return light;
+}
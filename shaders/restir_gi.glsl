@@ -0,0 +1,60 @@
+// reservoir based resampling of the primary hits' indirect light (ouyang 2021, restir gi), included by raytrace_common.glsl
+// after restir.glsl. the megakernel leaves a reservoir per pixel holding the points its first bsdf rays found and the
+// radiance the rest of their paths brought back from there, restir_gi.comp reuses them across frames and neighbours and
+// adds the primary hit's indirect light to the pixel. independent of the direct light reservoirs, both can run together
+
+const float GI_HISTORY_LIMIT = 20.f; // the previous frames count for at most this many times the new candidates
+const uint GI_SPATIAL_SAMPLES = 4;
+const float GI_SPATIAL_RADIUS = 16.f; // pixels
+const float GI_MISS_DISTANCE = 10000.f; // bsdf rays that leave the scene store a point this far along
+const float GI_MAX_JACOBIAN = 10.f; // neighbours that see the sample point too differently are skipped
+const uint GI_INITIAL_RESERVOIRS = 2; // the megakernel writes here, the two final halves come before it
+const uint GI_TEMPORAL_RESERVOIRS = 3;
+
+struct GIReservoir {
+    vec3 samplePoint; // secondary hit
+    uint sampleNormal; // octahedral
+    vec3 radiance; // leaving samplePoint towards the surface that found it, without its emission
+    float W;
+    float M;
+    uint normal; // octahedral normal of the primary hit the reservoir was built for
+    float depth; // its distance from the camera, negative when the pixel has no diffuse hit
+    uint padding;
+};
+
+// what restir_gi.comp needs to shade the pixel once it has the final sample
+struct GIPixel {
+    vec4 color; // rgb = the megakernel's color without the primary hit's indirect light
+    vec4 albedo; // rgb = the primary hit's diffuse albedo
+};
+
+// VulkanEngine::giReservoirBuffer, the header is written by the host every frame
+layout (std430, binding = 33) buffer GIReservoirs {
+    CameraInfo giPreviousCamera; // what the previous frame's reservoirs were built with
+    uint giFrame; // picks the final half that is written this frame
+    uint giHistory; // 0 when the previous frame's reservoirs can't be reused
+    uint giEnabled; // the megakernel fills the initial reservoirs and leaves storing its pixels to restir_gi.comp
+    uint giSpatial;
+    GIReservoir giReservoirs[]; // the final reservoirs of two frames, the megakernel's, then the temporal pass output
+};
+
+layout (std430, binding = 34) buffer GIPixels {
+    GIPixel giPixels[];
+};
+
+// set by the megakernel around its primary bounce. the bsdf ray's light is reused instead of weighted against the
+// shadow ray, so the shadow ray has to carry all of the direct light
+bool primaryIndirect = false;
+
+uint currentGIReservoirs() {
+    return giFrame & 1;
+}
+
+uint previousGIReservoirs() {
+    return (giFrame + 1) & 1;
+}
+
+// lambertian contribution of the sample at point, without the albedo and 1 / pi
+float giTarget(GIReservoir r, vec3 point, vec3 normal) {
+    return luminance(r.radiance) * max(0.f, dot(normal, normalize(r.samplePoint - point)));
+}
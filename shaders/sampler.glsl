@@ -0,0 +1,113 @@
+// low discrepancy sampling, included by raytrace_common.glsl once the push constants and random() exist.
+// every random decision of a path reads its own dimension, so each one is stratified over the samples of a pixel
+
+const uint SAMPLER_PCG = 0; // the white noise hash, ignores dimensions
+const uint SAMPLER_SOBOL = 1; // owen scrambled sobol, decorrelated per pixel
+const uint SAMPLER_BLUE_NOISE = 2; // one scrambled sobol sequence for every pixel, shifted by a blue noise mask
+
+// sobol is stratified within groups of 4 dimensions, so 2d samples never straddle a group.
+// the camera gets the first group, then every bounce two more
+const uint DIMENSION_LENS = 0; // 2d, reserved: the primary hit cache needs unjittered camera rays
+const uint CAMERA_DIMENSIONS = 4;
+const uint DIMENSION_BSDF = 0; // 2d
+const uint DIMENSION_LIGHT_POINT = 2; // 2d
+const uint DIMENSION_LIGHT_PICK = 4;
+const uint DIMENSION_BSDF_LOBE = 5;
+const uint DIMENSION_ROULETTE = 6;
+const uint DIMENSIONS_PER_BOUNCE = 8;
+
+const uint BLUE_NOISE_SIZE = 64;
+
+// uploaded once by the host, see vk_sampler.cpp
+layout (std430, binding = 25) readonly buffer SamplerTables {
+    uint sobolMatrices[4 * 32]; // generator matrix columns of the first 4 sobol dimensions, one per index bit
+    float blueNoise[BLUE_NOISE_SIZE * BLUE_NOISE_SIZE]; // void and cluster mask, ranks scaled to [0, 1)
+};
+
+struct SamplerState {
+    uvec2 pixel;
+    uint pixelHash;
+    uint sampleIndex; // counts across every frame accumulated so far
+    uint bounceDimension; // first dimension of the bounce being shaded
+};
+
+// set by the kernels at the start of every sample and by shadeHit at every bounce
+SamplerState samplerState;
+
+uint hashUint(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint hashCombine(uint seed, uint value) {
+    return seed ^ (hashUint(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// index of a sample across frames, sample counts within the current frame
+uint frameSampleIndex(uint index) {
+    RayTracerData traceData = PushConstants.rayTracerParams;
+    uint samples = traceData.singleRender ? traceData.sampleLimit : traceData.raysPerPixel;
+    return PushConstants.frameCount * max(samples, 1) + index;
+}
+
+void beginSample(ivec2 pixel, ivec2 dim, uint sampleIndex) {
+    samplerState.pixel = uvec2(pixel);
+    samplerState.pixelHash = hashUint(uint(pixel.y * dim.x + pixel.x));
+    samplerState.sampleIndex = sampleIndex;
+    samplerState.bounceDimension = 0;
+}
+
+void beginBounce(uint bounce) {
+    samplerState.bounceDimension = CAMERA_DIMENSIONS + bounce * DIMENSIONS_PER_BOUNCE;
+}
+
+uint sobolSample(uint index, uint dimension) {
+    uint result = 0;
+    for (uint bit = 0; index != 0; bit++, index >>= 1) {
+        if ((index & 1u) != 0) result ^= sobolMatrices[dimension * 32 + bit];
+    }
+    return result;
+}
+
+// burley 2020, practical hash-based owen scrambling
+uint laineKarrasPermutation(uint x, uint seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint nestedUniformScramble(uint x, uint seed) {
+    return bitfieldReverse(laineKarrasPermutation(bitfieldReverse(x), seed));
+}
+
+// 4d sobol, padded to any dimension by shuffling the sample index differently for each group of 4
+float sobolOwen(uint dimension, uint seed) {
+    uint index = nestedUniformScramble(samplerState.sampleIndex, hashCombine(seed, dimension / 4));
+    uint value = nestedUniformScramble(sobolSample(index, dimension % 4), hashCombine(seed, dimension + 0x85ebca6bu));
+    return float(value >> 8) / 16777216.f;
+}
+
+// next value of dimension offset within the current bounce, state is only used by the pcg sampler
+float sampleDimension(uint offset, inout uint state) {
+    uint dimension = samplerState.bounceDimension + offset;
+    uint samplerType = PushConstants.rayTracerParams.samplerType;
+    if (samplerType == SAMPLER_SOBOL) return sobolOwen(dimension, samplerState.pixelHash);
+    if (samplerType == SAMPLER_BLUE_NOISE) {
+        // every dimension reads the mask at its own offset so the shifts of different dimensions are uncorrelated
+        uvec2 texel = (samplerState.pixel + uvec2(dimension * 23u, dimension * 41u)) % BLUE_NOISE_SIZE;
+        return fract(sobolOwen(dimension, 0x2545f491u) + blueNoise[texel.y * BLUE_NOISE_SIZE + texel.x]);
+    }
+    return random(state);
+}
+
+vec2 sampleDimension2D(uint offset, inout uint state) {
+    float u = sampleDimension(offset, state);
+    return vec2(u, sampleDimension(offset + 1, state));
+}
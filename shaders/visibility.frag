@@ -0,0 +1,21 @@
+#version 450
+
+// writes the same record raytrace.comp stores for a traced primary hit: dst bits, triangle, object, unorm16 barycentrics
+
+layout (push_constant) uniform constants {
+    mat4 viewProjection;
+    vec4 cameraPos;
+} Visibility;
+
+layout (location = 0) in vec2 bary;
+layout (location = 1) in vec3 worldPos;
+layout (location = 2) flat in uint triangle;
+layout (location = 3) flat in uint hidden;
+layout (location = 4) flat in uint object;
+
+layout (location = 0) out uvec4 outHit;
+
+void main() {
+    if (hidden != 0) discard;
+    outHit = uvec4(floatBitsToUint(distance(worldPos, Visibility.cameraPos.xyz)), triangle, object, packUnorm2x16(bary));
+}
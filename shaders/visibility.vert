@@ -0,0 +1,55 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// visibility buffer pass: pulls each object's triangles straight from the tracer's buffers, one instance per RenderObject
+
+layout (push_constant) uniform constants {
+    mat4 viewProjection; // matches cameraRay, pixel corners land on fragment centers
+    vec4 cameraPos;
+} Visibility;
+
+#include "render_object.glsl"
+
+struct TriangleIntersect {
+    vec4 v0; // w = frontOnly
+    vec4 edge1;
+    vec4 edge2;
+};
+
+layout (std140, binding = 6) readonly buffer ObjectBuffer {
+    RenderObject objects[];
+};
+
+layout (std430, binding = 15) readonly buffer TriangleIntersectBuffer {
+    TriangleIntersect triangleIntersects[];
+};
+
+layout (location = 0) out vec2 bary;
+layout (location = 1) out vec3 worldPos;
+layout (location = 2) flat out uint triangle;
+layout (location = 3) flat out uint hidden;
+layout (location = 4) flat out uint object;
+
+void main() {
+    uint corner = gl_VertexIndex % 3;
+    triangle = gl_VertexIndex / 3;
+    object = gl_InstanceIndex;
+    RenderObject renderObject = objects[object];
+    TriangleIntersect tri = triangleIntersects[triangle];
+
+    vec3 position = tri.v0.xyz;
+    if (corner == 1) position += tri.edge1.xyz;
+    if (corner == 2) position += tri.edge2.xyz;
+
+    // same barycentrics as triangleHit: x weights v1, y weights v2
+    bary = vec2(corner == 1 ? 1.f : 0.f, corner == 2 ? 1.f : 0.f);
+
+    // rays never see the back of a front only triangle, culled per triangle in object space like the traversal does
+    vec3 objectCamera = (inverse(renderObject.transformMatrix) * vec4(Visibility.cameraPos.xyz, 1.f)).xyz;
+    bool backFace = dot(tri.v0.xyz - objectCamera, cross(tri.edge1.xyz, tri.edge2.xyz)) >= 0.f;
+    hidden = tri.v0.w != 0.f && backFace ? 1 : 0;
+
+    vec4 world = renderObject.transformMatrix * vec4(position, 1.f);
+    worldPos = world.xyz;
+    gl_Position = Visibility.viewProjection * world;
+}
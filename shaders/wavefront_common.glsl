@@ -0,0 +1,175 @@
+// shared by the wavefront stages, mirrors the Wavefront* structs in vk_engine.h
+#include "raytrace_common.glsl"
+
+const uint WAVEFRONT_GROUP_SIZE = 64;
+
+// queues 0 and 1 ping-pong the live paths between bounces, queue 2 holds this bounce's shadow rays
+// and queue 3 the active queue reordered by the sort stages
+const uint ACTIVE_QUEUE = 0;
+const uint SHADOW_QUEUE = 2;
+const uint SORTED_QUEUE = 3;
+
+const uint STAGE_GENERATE = 0;
+const uint STAGE_EXTEND = 1;
+const uint STAGE_SHADE = 2;
+const uint STAGE_CONNECT = 3;
+const uint STAGE_FINALIZE = 4;
+const uint STAGE_SORT_COUNT = 5;
+const uint STAGE_SORT_SCAN = 6;
+const uint STAGE_SORT_SCATTER = 7;
+
+struct QueueHeader {
+    uint count;
+    uint groupsX; // groupsX/Y/Z double as the indirect dispatch of the stage consuming the queue
+    uint groupsY;
+    uint groupsZ;
+};
+
+layout (std430, binding = 10) buffer WavefrontQueues {
+    QueueHeader queues[4];
+    uint stageCounters[8];
+};
+
+layout (std430, binding = 11) buffer WavefrontQueueItems {
+    uint queueItems[];
+};
+
+struct WavefrontPath {
+    vec3 origin;
+    uint rngState;
+    vec3 dir;
+    uint bounce;
+    vec3 attenuation;
+    float bsdfPDF;
+    vec3 totalColor;
+    float boxTests;
+    vec3 directLight;
+    float triTests;
+    vec3 sampleSum;
+    uint pixelIndex;
+    float shadowBoxTests;
+    float shadowTriTests;
+};
+
+layout (std430, binding = 12) buffer WavefrontPaths {
+    WavefrontPath paths[];
+};
+
+// shade resolves the attributes itself, so only the traversal result is kept between stages
+layout (std430, binding = 13) buffer WavefrontHits {
+    HitRecord hits[];
+};
+
+// counting sort of the active queue, see sortKey
+const uint SORT_BUCKETS = 256;
+const float SORT_CELL_SIZE = 0.5f;
+
+layout (std430, binding = 16) buffer WavefrontSort {
+    uint bucketCounts[SORT_BUCKETS];
+    uint bucketOffsets[SORT_BUCKETS];
+    uvec2 sortKeys[]; // (key, rank within its bucket) per active queue slot
+};
+
+struct WavefrontShadowRay {
+    vec3 origin;
+    float bsdfPDF;
+    vec3 dir;
+    float tMax;
+    vec3 brdf;
+    float lightPDF;
+    vec3 emission;
+};
+
+layout (std430, binding = 14) buffer WavefrontShadowRays {
+    WavefrontShadowRay shadowRays[];
+};
+
+uint poolSize() {
+    return uint(paths.length());
+}
+
+ivec2 poolPixel(uint pixelIndex, ivec2 dim) {
+    return ivec2(pixelIndex % uint(dim.x), pixelIndex / uint(dim.x));
+}
+
+// index of this invocation's path in the given queue, or -1 past the end of it
+int queueItem(uint queue) {
+    if (gl_GlobalInvocationID.x >= queues[queue].count) return -1;
+    return int(queueItems[queue * poolSize() + gl_GlobalInvocationID.x]);
+}
+
+// appends to a queue with one atomic per subgroup and grows the queue's indirect dispatch to fit
+void queuePush(uint queue, uint pathIndex) {
+    uvec4 ballot = subgroupBallot(true);
+    uint count = subgroupBallotBitCount(ballot);
+    uint base = 0;
+    if (subgroupElect()) {
+        base = atomicAdd(queues[queue].count, count);
+        atomicMax(queues[queue].groupsX, (base + count + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE);
+    }
+    base = subgroupBroadcastFirst(base);
+    queueItems[queue * poolSize() + base + subgroupBallotExclusiveBitCount(ballot)] = pathIndex;
+}
+
+float[4] loadStats(uint pathIndex) {
+    WavefrontPath stored = paths[pathIndex];
+    float stats[4] = {stored.boxTests, stored.triTests, stored.shadowBoxTests, stored.shadowTriTests};
+    return stats;
+}
+
+void saveStats(uint pathIndex, float stats[4]) {
+    paths[pathIndex].boxTests = stats[0];
+    paths[pathIndex].triTests = stats[1];
+    paths[pathIndex].shadowBoxTests = stats[2];
+    paths[pathIndex].shadowTriTests = stats[3];
+}
+
+// material class of the hit (2 bits), ray direction octant (3 bits) and the parity of the hit point's
+// grid cell (3 bits), so a workgroup ends up shading one kind of material with rays heading the same way
+uint sortKey(uint pathIndex) {
+    HitRecord record = hits[pathIndex];
+    uint materialClass = 3; // miss
+    if (record.objectIndex != NO_HIT) {
+        uint materialIndex = record.objectIndex == SPHERE_HIT ? spheres[record.primIndex].materialIndex : objects[record.objectIndex].materialIndex;
+        Material material = materials[materialIndex];
+        materialClass = material.reflectance != 0 ? 1 : material.ior != -1 ? 2 : 0;
+    }
+
+    vec3 dir = paths[pathIndex].dir;
+    uint octant = uint(dir.x < 0) | uint(dir.y < 0) << 1 | uint(dir.z < 0) << 2;
+
+    vec3 hitPoint = paths[pathIndex].origin + dir * min(record.dst, 1000.f);
+    uvec3 cell = uvec3(ivec3(floor(hitPoint / SORT_CELL_SIZE))) & 1u;
+    uint position = cell.x | cell.y << 1 | cell.z << 2;
+    return materialClass << 6 | octant << 3 | position;
+}
+
+// cumulative per frame items processed by a stage, read back for the render stats
+void countStage(uint stage) {
+    uvec4 ballot = subgroupBallot(true);
+    if (subgroupElect()) atomicAdd(stageCounters[stage], subgroupBallotBitCount(ballot));
+}
+
+PathState loadPath(uint pathIndex) {
+    WavefrontPath stored = paths[pathIndex];
+    PathState path;
+    path.ray.origin = stored.origin;
+    path.ray.dir = stored.dir;
+    path.totalColor = stored.totalColor;
+    path.attenuation = stored.attenuation;
+    path.directLight = stored.directLight;
+    path.bsdfPDF = stored.bsdfPDF;
+    path.bounce = stored.bounce;
+    path.directResampled = false;
+    return path;
+}
+
+void savePath(uint pathIndex, PathState path) {
+    paths[pathIndex].origin = path.ray.origin;
+    paths[pathIndex].dir = path.ray.dir;
+    paths[pathIndex].totalColor = path.totalColor;
+    paths[pathIndex].attenuation = path.attenuation;
+    paths[pathIndex].directLight = path.directLight;
+    paths[pathIndex].bsdfPDF = path.bsdfPDF;
+    paths[pathIndex].bounce = path.bounce;
+}
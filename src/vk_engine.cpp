@@ -8,9 +8,12 @@
 
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <algorithm>
 
 #include "VkBootstrap.h"
 #include "vk_textures.h"
+#include <stb_image.h>
 
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
@@ -49,12 +52,15 @@ void VulkanEngine::init() {
 	init_framebuffers();
 	init_sync_structures();
 	init_descriptors();
-	init_pipelines();
 	init_image();
+	init_visibility_pass();
 	init_imgui();
 
 	generate_quad();
 	prepare_storage_buffers();
+	//after the scene is loaded, the bvh cache size is a specialization constant
+	init_pipelines();
+	allocate_views(1, viewExtent);
 	update_descriptors();
 
 	// for (int i = 0; i < triangles.size(); i++) {
@@ -92,23 +98,136 @@ void VulkanEngine::init_vulkan() {
 	//pick gpu
 	SDL_Vulkan_CreateSurface(_window, instance, &surface);
 
+	//ray queries on a 1.1 device need the 1.2 extensions they depend on, all optional
+	std::vector<const char*> rayQueryExtensions = {
+		VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
+		VK_KHR_RAY_QUERY_EXTENSION_NAME,
+		VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
+		VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
+		VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+		VK_KHR_SPIRV_1_4_EXTENSION_NAME,
+		VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME
+	};
+
 	vkb::PhysicalDeviceSelector selector{ vkb_inst };
 	vkb::PhysicalDevice physicalDevice = selector.set_minimum_version(1, 1)
 		.set_surface(surface)
+		.add_desired_extensions(rayQueryExtensions)
 		.select()
 		.value();
 
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice.physical_device, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> deviceExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice.physical_device, nullptr, &extensionCount, deviceExtensions.data());
+
+	rayQuerySupported = true;
+	for (const char* extension : rayQueryExtensions) {
+		bool found = false;
+		for (VkExtensionProperties& properties : deviceExtensions) {
+			found |= strcmp(properties.extensionName, extension) == 0;
+		}
+		rayQuerySupported &= found;
+	}
+
+	VkPhysicalDeviceBufferDeviceAddressFeatures addressFeatures{};
+	addressFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES;
+	VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeatures{};
+	accelFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+	VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures{};
+	rayQueryFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+
+	if (rayQuerySupported) {
+		accelFeatures.pNext = &addressFeatures;
+		rayQueryFeatures.pNext = &accelFeatures;
+		VkPhysicalDeviceFeatures2 features2{};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &rayQueryFeatures;
+		vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &features2);
+		rayQuerySupported = addressFeatures.bufferDeviceAddress && accelFeatures.accelerationStructure && rayQueryFeatures.rayQuery;
+	}
+	cout << "Ray Query: " << (rayQuerySupported ? "supported" : "not supported (software bvh only)") << endl;
+
 	// build logical device
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
 	VkPhysicalDeviceShaderDrawParametersFeatures shader_draw_parameters_features{};
 	shader_draw_parameters_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_DRAW_PARAMETER_FEATURES;
 	shader_draw_parameters_features.shaderDrawParameters = VK_TRUE;
-	vkb::Device vkbDevice = deviceBuilder.add_pNext(&shader_draw_parameters_features).build().value();
+	deviceBuilder.add_pNext(&shader_draw_parameters_features);
+
+	//only the features the traversal uses, the rest of the queried structs stay off
+	if (rayQuerySupported) {
+		addressFeatures = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES};
+		addressFeatures.bufferDeviceAddress = VK_TRUE;
+		accelFeatures = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR};
+		accelFeatures.accelerationStructure = VK_TRUE;
+		rayQueryFeatures = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR};
+		rayQueryFeatures.rayQuery = VK_TRUE;
+		deviceBuilder.add_pNext(&addressFeatures).add_pNext(&accelFeatures).add_pNext(&rayQueryFeatures);
+	}
+	vkb::Device vkbDevice = deviceBuilder.build().value();
 
 	device = vkbDevice.device;
 	this->physicalDevice = physicalDevice.physical_device;
 	gpuProperties = vkbDevice.physical_device.properties;
 
+	//persistent threads and wavefront queues fetch/push work with subgroup ops
+	VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+	subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+	VkPhysicalDeviceProperties2 properties2{};
+	properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties2.pNext = &subgroupProperties;
+	vkGetPhysicalDeviceProperties2(this->physicalDevice, &properties2);
+
+	VkSubgroupFeatureFlags subgroupOps = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT | VK_SUBGROUP_FEATURE_VOTE_BIT;
+	subgroupSupported = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) && (subgroupProperties.supportedOperations & subgroupOps) == subgroupOps;
+	cout << "Subgroup Size: " << subgroupProperties.subgroupSize << (subgroupSupported ? "" : " (no persistent threads/wavefront)") << endl;
+
+	//persistent threads only need as many workgroups as the gpu keeps resident at once, vendors that report their
+	//core layout give that directly, the rest keep the default
+	auto hasExtension = [&](const char* name) {
+		for (VkExtensionProperties& properties : deviceExtensions) {
+			if (strcmp(properties.extensionName, name) == 0) return true;
+		}
+		return false;
+	};
+	uint residentInvocations = 0;
+	if (hasExtension(VK_NV_SHADER_SM_BUILTINS_EXTENSION_NAME)) {
+		VkPhysicalDeviceShaderSMBuiltinsPropertiesNV smProperties{};
+		smProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_SM_BUILTINS_PROPERTIES_NV;
+		properties2.pNext = &smProperties;
+		vkGetPhysicalDeviceProperties2(this->physicalDevice, &properties2);
+		residentInvocations = smProperties.shaderSMCount * smProperties.shaderWarpsPerSM * subgroupProperties.subgroupSize;
+	} else if (hasExtension(VK_AMD_SHADER_CORE_PROPERTIES_EXTENSION_NAME)) {
+		VkPhysicalDeviceShaderCorePropertiesAMD coreProperties{};
+		coreProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CORE_PROPERTIES_AMD;
+		properties2.pNext = &coreProperties;
+		vkGetPhysicalDeviceProperties2(this->physicalDevice, &properties2);
+		uint computeUnits = coreProperties.shaderEngineCount * coreProperties.shaderArraysPerEngineCount * coreProperties.computeUnitsPerShaderArray;
+		residentInvocations = computeUnits * coreProperties.simdPerComputeUnit * coreProperties.wavefrontsPerSimd * coreProperties.wavefrontSize;
+	}
+	//the megakernel's registers keep it well below full occupancy, a quarter of the resident waves still covers the latency
+	//and the work queue balances whatever is left over. workgroups are 64 invocations
+	if (residentInvocations > 0) persistentWorkgroups = std::max(residentInvocations / 4 / 64, 1u);
+	cout << "Persistent Workgroups: " << persistentWorkgroups << (residentInvocations > 0 ? "" : " (default)") << endl;
+
+	if (rayQuerySupported) {
+		vkGetBufferDeviceAddressKHR = (PFN_vkGetBufferDeviceAddressKHR) vkGetDeviceProcAddr(device, "vkGetBufferDeviceAddressKHR");
+		vkCreateAccelerationStructureKHR = (PFN_vkCreateAccelerationStructureKHR) vkGetDeviceProcAddr(device, "vkCreateAccelerationStructureKHR");
+		vkDestroyAccelerationStructureKHR = (PFN_vkDestroyAccelerationStructureKHR) vkGetDeviceProcAddr(device, "vkDestroyAccelerationStructureKHR");
+		vkGetAccelerationStructureBuildSizesKHR = (PFN_vkGetAccelerationStructureBuildSizesKHR) vkGetDeviceProcAddr(device, "vkGetAccelerationStructureBuildSizesKHR");
+		vkGetAccelerationStructureDeviceAddressKHR = (PFN_vkGetAccelerationStructureDeviceAddressKHR) vkGetDeviceProcAddr(device, "vkGetAccelerationStructureDeviceAddressKHR");
+		vkCmdBuildAccelerationStructuresKHR = (PFN_vkCmdBuildAccelerationStructuresKHR) vkGetDeviceProcAddr(device, "vkCmdBuildAccelerationStructuresKHR");
+
+		VkPhysicalDeviceAccelerationStructurePropertiesKHR accelProperties{};
+		accelProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+		VkPhysicalDeviceProperties2 accelProperties2{};
+		accelProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		accelProperties2.pNext = &accelProperties;
+		vkGetPhysicalDeviceProperties2(this->physicalDevice, &accelProperties2);
+		scratchAlignment = accelProperties.minAccelerationStructureScratchOffsetAlignment;
+	}
+
 	graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
 	graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
@@ -116,12 +235,26 @@ void VulkanEngine::init_vulkan() {
 	computeQueue = graphicsQueue;
 	computeQueueFamily = graphicsQueueFamily;
 
+	//timestamps are only meaningful in as many bits as the queue family reports
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(this->physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(this->physicalDevice, &familyCount, families.data());
+
+	//enough scopes for a wavefront frame at a few samples, run_compute grows the pool for bigger ones
+	profiler.init(device, gpuProperties, families[computeQueueFamily].timestampValidBits, 4096);
+
 	// create memory allocator
 	VmaAllocatorCreateInfo allocatorInfo{};
 	allocatorInfo.device = device;
 	allocatorInfo.physicalDevice = physicalDevice.physical_device;
 	allocatorInfo.instance = instance;
+	if (rayQuerySupported) allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
 	vmaCreateAllocator(&allocatorInfo, &allocator);
+
+	deletionQueue.push_function([=]() {
+		profiler.destroy(device);
+	});
 }
 
 void VulkanEngine::init_swapchain() {
@@ -264,6 +397,91 @@ void VulkanEngine::init_framebuffers() {
 	}	
 }
 
+//visibility pass: writes primary hit records into primaryHitImage, depth tested against its own depth buffer
+void VulkanEngine::init_visibility_pass() {
+	VkExtent3D depthExtent = {_windowExtent.width, _windowExtent.height, 1};
+	VkImageCreateInfo depthInfo = vkinit::imageCreateInfo(VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthExtent);
+	VmaAllocationCreateInfo depthAllocInfo{};
+	depthAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	VK_CHECK(vmaCreateImage(allocator, &depthInfo, &depthAllocInfo, &visibilityDepth.image, &visibilityDepth.allocation, nullptr));
+
+	VkImageViewCreateInfo depthViewInfo = vkinit::imageViewCreateInfo(VK_FORMAT_D32_SFLOAT, visibilityDepth.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+	VK_CHECK(vkCreateImageView(device, &depthViewInfo, nullptr, &visibilityDepthView));
+
+	//the hit image stays in general layout, the megakernel reads and writes it as a storage image
+	VkAttachmentDescription attachments[2] = {};
+	attachments[0].format = VK_FORMAT_R32G32B32A32_UINT;
+	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_GENERAL;
+	attachments[0].finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	attachments[1].format = VK_FORMAT_D32_SFLOAT;
+	attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference hitRef = {0, VK_IMAGE_LAYOUT_GENERAL};
+	VkAttachmentReference depthRef = {1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &hitRef;
+	subpass.pDepthStencilAttachment = &depthRef;
+
+	//after the previous frame's megakernel is done with the image, and before this frame's reads it
+	VkSubpassDependency dependencies[2] = {};
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = 2;
+	renderPassInfo.pAttachments = attachments;
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = 2;
+	renderPassInfo.pDependencies = dependencies;
+	VK_CHECK(vkCreateRenderPass(device, &renderPassInfo, nullptr, &visibilityPass));
+
+	VkImageView framebufferViews[2] = {primaryHitImage.imageView, visibilityDepthView};
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = visibilityPass;
+	framebufferInfo.attachmentCount = 2;
+	framebufferInfo.pAttachments = framebufferViews;
+	framebufferInfo.width = _windowExtent.width;
+	framebufferInfo.height = _windowExtent.height;
+	framebufferInfo.layers = 1;
+	VK_CHECK(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &visibilityFramebuffer));
+
+	deletionQueue.push_function([=]() {
+		vkDestroyFramebuffer(device, visibilityFramebuffer, nullptr);
+		vkDestroyRenderPass(device, visibilityPass, nullptr);
+		vkDestroyImageView(device, visibilityDepthView, nullptr);
+		vmaDestroyImage(allocator, visibilityDepth.image, visibilityDepth.allocation);
+	});
+}
+
 void VulkanEngine::init_sync_structures() {
 	VkFenceCreateInfo fenceInfo = vkinit::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
 	VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphoreCreateInfo();
@@ -320,8 +538,8 @@ void VulkanEngine::init_pipelines() {
 		cout << "successfully loaded vertex shader" << endl;
 	}
 
-	VkShaderModule compute;
-	if (!load_shader_module((bin + "raytrace.comp.spv").c_str(), &compute)) {
+	//kept for the lifetime of the engine, megakernel variants are compiled from it on demand
+	if (!load_shader_module((bin + "raytrace.comp.spv").c_str(), &megakernelModule)) {
 		cout << "error loading compute shader" << endl;
 	} else {
 		cout << "successfully loaded compute shader" << endl;
@@ -382,20 +600,173 @@ void VulkanEngine::init_pipelines() {
 
 	graphicsPipeline = builder.build_pipeline(device, renderPass);
 
-	VkComputePipelineCreateInfo computePipelineInfo = vkinit::computePipelineCreateInfo(computePipeLayout);
-	computePipelineInfo.stage = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, compute);
-	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &computePipeline));
+	//visibility pass, pulls its vertices from the compute set so it needs no vertex input
+	VkShaderModule visibilityVertex;
+	VkShaderModule visibilityFragment;
+	bool visibilityLoaded = load_shader_module((bin + "visibility.vert.spv").c_str(), &visibilityVertex);
+	if (!load_shader_module((bin + "visibility.frag.spv").c_str(), &visibilityFragment)) {
+		if (visibilityLoaded) vkDestroyShaderModule(device, visibilityVertex, nullptr);
+		visibilityLoaded = false;
+	}
+
+	VkPushConstantRange visibilityConstants;
+	visibilityConstants.offset = 0;
+	visibilityConstants.size = sizeof(VisibilityConstants);
+	visibilityConstants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkPipelineLayoutCreateInfo visibilityLayoutInfo = vkinit::pipelineLayoutCreateInfo();
+	visibilityLayoutInfo.pSetLayouts = &computeLayout;
+	visibilityLayoutInfo.setLayoutCount = 1;
+	visibilityLayoutInfo.pushConstantRangeCount = 1;
+	visibilityLayoutInfo.pPushConstantRanges = &visibilityConstants;
+	VK_CHECK(vkCreatePipelineLayout(device, &visibilityLayoutInfo, nullptr, &visibilityPipelineLayout));
+
+	if (visibilityLoaded) {
+		PipelineBuilder visibilityBuilder = builder;
+		visibilityBuilder._vertexInputInfo = vkinit::pipelineVertexInputStateCreateInfo();
+		visibilityBuilder._viewport.minDepth = 0.f;
+		visibilityBuilder._viewport.maxDepth = 1.f;
+		//reversed infinite depth, see camera_view_projection
+		visibilityBuilder._depthStencil = vkinit::depthStencilCreateInfo(VK_TRUE, VK_TRUE, VK_COMPARE_OP_GREATER);
+		visibilityBuilder._shaderStages.clear();
+		visibilityBuilder._shaderStages.push_back(vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, visibilityVertex));
+		visibilityBuilder._shaderStages.push_back(vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, visibilityFragment));
+		visibilityBuilder._pipelineLayout = visibilityPipelineLayout;
+		visibilityPipeline = visibilityBuilder.build_pipeline(device, visibilityPass);
+
+		vkDestroyShaderModule(device, visibilityVertex, nullptr);
+		vkDestroyShaderModule(device, visibilityFragment, nullptr);
+	} else {
+		cout << "error loading visibility shaders, primary hits are traced" << endl;
+	}
+
+	//every kernel that includes the traversal gets the same bvh cache size
+	VkSpecializationMapEntry cacheEntry{0, 0, sizeof(uint32_t)};
+	VkSpecializationInfo cacheSpecialization{1, &cacheEntry, sizeof(uint32_t), &bvhCacheNodes};
+
+	//same megakernel with the triangle traversal swapped for rayQueryEXT
+	if (rayQuerySupported && !load_shader_module((bin + "raytrace_rq.comp.spv").c_str(), &rayQueryModule)) {
+		rayQueryModule = VK_NULL_HANDLE;
+	}
+
+	//the persistent threads builds fetch pixels with subgroup ops, so they are only loaded where those exist
+	if (subgroupSupported && !load_shader_module((bin + "raytrace_persistent.comp.spv").c_str(), &persistentModule)) {
+		persistentModule = VK_NULL_HANDLE;
+	}
+	if (subgroupSupported && rayQueryModule != VK_NULL_HANDLE && !load_shader_module((bin + "raytrace_rq_persistent.comp.spv").c_str(), &rayQueryPersistentModule)) {
+		rayQueryPersistentModule = VK_NULL_HANDLE;
+	}
+
+	//wavefront stages share the compute layout and descriptor set
+	const char* wavefrontShaders[WAVEFRONT_STAGES] = {"wavefront_generate", "wavefront_extend", "wavefront_shade", "wavefront_connect", "wavefront_finalize",
+		"wavefront_sort_count", "wavefront_sort_scan", "wavefront_sort_scatter"};
+	for (int i = 0; i < WAVEFRONT_STAGES; i++) {
+		VkShaderModule stageModule;
+		//every stage pushes and pops its queues with subgroup ballot, the megakernel covers devices without it
+		if (!subgroupSupported) {
+			wavefrontPipelines[i] = VK_NULL_HANDLE;
+			continue;
+		}
+		if (!load_shader_module((bin + wavefrontShaders[i] + ".comp.spv").c_str(), &stageModule)) {
+			cout << "error loading " << wavefrontShaders[i] << " shader" << endl;
+			wavefrontPipelines[i] = VK_NULL_HANDLE;
+			continue;
+		}
+
+		VkComputePipelineCreateInfo stageInfo = vkinit::computePipelineCreateInfo(computePipeLayout);
+		stageInfo.stage = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, stageModule);
+		stageInfo.stage.pSpecializationInfo = &cacheSpecialization;
+		VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &stageInfo, nullptr, &wavefrontPipelines[i]));
+		vkDestroyShaderModule(device, stageModule, nullptr);
+	}
+
+	//adaptive sampling shares the layout too, without it every pixel is traced every frame.
+	//the compaction appends with subgroup ballot, so the pipeline stays null and the feature off without it
+	VkShaderModule adaptiveModule;
+	if (!subgroupSupported) {
+		cout << "no subgroup ballot, adaptive sampling is off" << endl;
+	} else if (load_shader_module((bin + "adaptive_compact.comp.spv").c_str(), &adaptiveModule)) {
+		VkComputePipelineCreateInfo adaptiveInfo = vkinit::computePipelineCreateInfo(computePipeLayout);
+		adaptiveInfo.stage = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, adaptiveModule);
+		adaptiveInfo.stage.pSpecializationInfo = &cacheSpecialization;
+		VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &adaptiveInfo, nullptr, &adaptivePipeline));
+		vkDestroyShaderModule(device, adaptiveModule, nullptr);
+	} else {
+		cout << "error loading adaptive_compact shader, adaptive sampling is off" << endl;
+	}
+
+	VkShaderModule guideModule;
+	if (load_shader_module((bin + "guide_update.comp.spv").c_str(), &guideModule)) {
+		VkComputePipelineCreateInfo guideInfo = vkinit::computePipelineCreateInfo(computePipeLayout);
+		guideInfo.stage = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, guideModule);
+		guideInfo.stage.pSpecializationInfo = &cacheSpecialization;
+		VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &guideInfo, nullptr, &guidePipeline));
+		vkDestroyShaderModule(device, guideModule, nullptr);
+	} else {
+		cout << "error loading guide_update shader, path guiding is off" << endl;
+	}
+
+	//both restir passes come from one shader, RESTIR_PASS (id 9) picks which
+	VkShaderModule restirModule;
+	if (load_shader_module((bin + "restir.comp.spv").c_str(), &restirModule)) {
+		uint32_t restirConstants[2] = {bvhCacheNodes, 0};
+		VkSpecializationMapEntry restirEntries[2] = {{0, 0, sizeof(uint32_t)}, {9, sizeof(uint32_t), sizeof(uint32_t)}};
+		VkSpecializationInfo restirSpecialization{2, restirEntries, sizeof(restirConstants), restirConstants};
+		for (uint pass = 0; pass < 2; pass++) {
+			restirConstants[1] = pass;
+			VkComputePipelineCreateInfo restirInfo = vkinit::computePipelineCreateInfo(computePipeLayout);
+			restirInfo.stage = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, restirModule);
+			restirInfo.stage.pSpecializationInfo = &restirSpecialization;
+			VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &restirInfo, nullptr, &restirPipelines[pass]));
+		}
+		vkDestroyShaderModule(device, restirModule, nullptr);
+	} else {
+		cout << "error loading restir shader, direct light is sampled per path" << endl;
+	}
+
+	VkShaderModule restirGIModule;
+	if (load_shader_module((bin + "restir_gi.comp.spv").c_str(), &restirGIModule)) {
+		uint32_t restirGIConstants[2] = {bvhCacheNodes, 0};
+		VkSpecializationMapEntry restirGIEntries[2] = {{0, 0, sizeof(uint32_t)}, {9, sizeof(uint32_t), sizeof(uint32_t)}};
+		VkSpecializationInfo restirGISpecialization{2, restirGIEntries, sizeof(restirGIConstants), restirGIConstants};
+		for (uint pass = 0; pass < 2; pass++) {
+			restirGIConstants[1] = pass;
+			VkComputePipelineCreateInfo restirGIInfo = vkinit::computePipelineCreateInfo(computePipeLayout);
+			restirGIInfo.stage = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, restirGIModule);
+			restirGIInfo.stage.pSpecializationInfo = &restirGISpecialization;
+			VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &restirGIInfo, nullptr, &restirGIPipelines[pass]));
+		}
+		vkDestroyShaderModule(device, restirGIModule, nullptr);
+	} else {
+		cout << "error loading restir_gi shader, indirect light is traced per path" << endl;
+	}
 
 	//can delete after pipeline creation
 	vkDestroyShaderModule(device, fragment, nullptr);
 	vkDestroyShaderModule(device, vertex, nullptr);
-	vkDestroyShaderModule(device, compute, nullptr);
 
 	deletionQueue.push_function([=]() {
 		vkDestroyPipelineLayout(device, computePipeLayout, nullptr);
-		vkDestroyPipeline(device, computePipeline, nullptr);
+		for (auto& variant : megakernelVariants) {
+			vkDestroyPipeline(device, variant.second, nullptr);
+		}
+		vkDestroyShaderModule(device, megakernelModule, nullptr);
+		vkDestroyShaderModule(device, rayQueryModule, nullptr);
+		vkDestroyShaderModule(device, persistentModule, nullptr);
+		vkDestroyShaderModule(device, rayQueryPersistentModule, nullptr);
+		for (int i = 0; i < WAVEFRONT_STAGES; i++) {
+			vkDestroyPipeline(device, wavefrontPipelines[i], nullptr);
+		}
+		vkDestroyPipeline(device, adaptivePipeline, nullptr);
+		vkDestroyPipeline(device, guidePipeline, nullptr);
+		vkDestroyPipeline(device, restirPipelines[0], nullptr);
+		vkDestroyPipeline(device, restirPipelines[1], nullptr);
+		vkDestroyPipeline(device, restirGIPipelines[0], nullptr);
+		vkDestroyPipeline(device, restirGIPipelines[1], nullptr);
 		vkDestroyPipelineLayout(device, graphicsPipelineLayout, nullptr);
 		vkDestroyPipeline(device, graphicsPipeline, nullptr);
+		vkDestroyPipelineLayout(device, visibilityPipelineLayout, nullptr);
+		vkDestroyPipeline(device, visibilityPipeline, nullptr);
 	});
 }
 
@@ -403,12 +774,13 @@ void VulkanEngine::init_descriptors() {
 	std::vector<VkDescriptorPoolSize> sizes = {
 		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
 		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10},
-		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10},
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 32},
 		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10},
 		{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 32},
 		{VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 128},
 		{VK_DESCRIPTOR_TYPE_SAMPLER, 2},
 	};
+	if (rayQuerySupported) sizes.push_back({VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1});
 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -435,19 +807,54 @@ void VulkanEngine::init_descriptors() {
 	VkDescriptorSetLayoutBinding materialBufferBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3);
 	VkDescriptorSetLayoutBinding triPointBufferBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4);
 	VkDescriptorSetLayoutBinding triangleBufferBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 5);
-	VkDescriptorSetLayoutBinding objectBufferBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 6);
+	VkDescriptorSetLayoutBinding objectBufferBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 6);
 	VkDescriptorSetLayoutBinding bvhBufferBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 7);
 	VkDescriptorSetLayoutBinding samplerBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 8);
+	VkDescriptorSetLayoutBinding workQueueBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 9);
+	VkDescriptorSetLayoutBinding wavefrontQueueBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 10);
+	VkDescriptorSetLayoutBinding wavefrontItemBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 11);
+	VkDescriptorSetLayoutBinding wavefrontPathBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 12);
+	VkDescriptorSetLayoutBinding wavefrontHitBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 13);
+	VkDescriptorSetLayoutBinding wavefrontShadowBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 14);
+	//objects and triangle intersects are also pulled by the visibility pass
+	VkDescriptorSetLayoutBinding triIntersectBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 15);
+	VkDescriptorSetLayoutBinding wavefrontSortBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 16);
+	VkDescriptorSetLayoutBinding sphereBvhBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 18);
+	VkDescriptorSetLayoutBinding primaryHitBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 19);
+	VkDescriptorSetLayoutBinding viewBufferBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 20);
+	VkDescriptorSetLayoutBinding viewImageBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 21);
+	VkDescriptorSetLayoutBinding lightBufferBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 22);
+	VkDescriptorSetLayoutBinding lightTreeBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 23);
+	VkDescriptorSetLayoutBinding lightSlotBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 24);
+	VkDescriptorSetLayoutBinding samplerTableBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 25);
+	VkDescriptorSetLayoutBinding accumulationBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 26);
+	VkDescriptorSetLayoutBinding luminanceM2Binding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 27);
+	VkDescriptorSetLayoutBinding adaptiveBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 28);
+	VkDescriptorSetLayoutBinding environmentMapBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 29);
+	VkDescriptorSetLayoutBinding environmentCDFBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 30);
+	VkDescriptorSetLayoutBinding guideBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 31);
+	VkDescriptorSetLayoutBinding reservoirBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 32);
+	VkDescriptorSetLayoutBinding giReservoirBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 33);
+	VkDescriptorSetLayoutBinding giPixelBinding = vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 34);
 
 	textureBufferBinding.descriptorCount = MAX_TEXTURES;
 	samplerBinding.descriptorCount = 2;
 
-	VkDescriptorSetLayoutBinding computeBindings[] = {computeBinding, sphereBufferBinding, materialBufferBinding, textureBufferBinding, triPointBufferBinding, triangleBufferBinding, objectBufferBinding, bvhBufferBinding, samplerBinding};
+	std::vector<VkDescriptorSetLayoutBinding> computeBindings = {computeBinding, sphereBufferBinding, materialBufferBinding, textureBufferBinding, triPointBufferBinding, triangleBufferBinding, objectBufferBinding, bvhBufferBinding, samplerBinding, workQueueBinding,
+		wavefrontQueueBinding, wavefrontItemBinding, wavefrontPathBinding, wavefrontHitBinding, wavefrontShadowBinding, triIntersectBinding, wavefrontSortBinding, sphereBvhBinding, primaryHitBinding,
+		viewBufferBinding, viewImageBinding, lightBufferBinding, lightTreeBinding, lightSlotBinding, samplerTableBinding,
+		accumulationBinding, luminanceM2Binding, adaptiveBinding, environmentMapBinding, environmentCDFBinding, guideBinding, reservoirBinding,
+		giReservoirBinding, giPixelBinding};
+
+	//the tlas binding only exists on devices that can build one, the software shaders never declare it
+	if (rayQuerySupported) {
+		computeBindings.push_back(vkinit::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_SHADER_STAGE_COMPUTE_BIT, 17));
+	}
 
 	VkDescriptorSetLayoutCreateInfo computeSetInfo{};
 	computeSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	computeSetInfo.bindingCount = 9;
-	computeSetInfo.pBindings = computeBindings;
+	computeSetInfo.bindingCount = computeBindings.size();
+	computeSetInfo.pBindings = computeBindings.data();
 
 	vkCreateDescriptorSetLayout(device, &computeSetInfo, nullptr, &computeLayout);
 
@@ -563,10 +970,20 @@ void VulkanEngine::update_descriptors() {
 	compImageInfo.imageView = computeImage.imageView;
 	compImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
-	VkDescriptorBufferInfo sphereBufferInfo;
-	sphereBufferInfo.buffer = sphereBuffer.buffer;
-	sphereBufferInfo.offset = 0;
-	sphereBufferInfo.range = sizeof(Sphere) * MAX_SPHERES;
+	VkDescriptorImageInfo primaryHitInfo;
+	primaryHitInfo.sampler = sampler;
+	primaryHitInfo.imageView = primaryHitImage.imageView;
+	primaryHitInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkDescriptorImageInfo accumulationInfo;
+	accumulationInfo.sampler = sampler;
+	accumulationInfo.imageView = accumulationImage.imageView;
+	accumulationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkDescriptorImageInfo luminanceM2Info;
+	luminanceM2Info.sampler = sampler;
+	luminanceM2Info.imageView = luminanceM2Image.imageView;
+	luminanceM2Info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
 	VkDescriptorBufferInfo materialBufferInfo;
 	materialBufferInfo.buffer = materialBuffer.buffer;
@@ -602,13 +1019,108 @@ void VulkanEngine::update_descriptors() {
 
 	VkWriteDescriptorSet compTex = vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, computeSet, &compImageInfo, 0);
 	VkWriteDescriptorSet textureWrite = vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, computeSet, textureImageInfos, 1);
-	VkWriteDescriptorSet sphereWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &sphereBufferInfo, 2);
+	VkWriteDescriptorSet primaryHitWrite = vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, computeSet, &primaryHitInfo, 19);
+	VkWriteDescriptorSet accumulationWrite = vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, computeSet, &accumulationInfo, 26);
+	VkWriteDescriptorSet luminanceM2Write = vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, computeSet, &luminanceM2Info, 27);
 	VkWriteDescriptorSet materialWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &materialBufferInfo, 3);
 	VkWriteDescriptorSet triPointWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &triPointBufferInfo, 4);
 	VkWriteDescriptorSet triangleWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &triangleBufferInfo, 5);
 	VkWriteDescriptorSet objectWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &objectBufferInfo, 6);
 	VkWriteDescriptorSet bvhWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &bvhBufferInfo, 7);
 
+	VkDescriptorBufferInfo triIntersectBufferInfo;
+	triIntersectBufferInfo.buffer = triIntersectBuffer.buffer;
+	triIntersectBufferInfo.offset = 0;
+	triIntersectBufferInfo.range = sizeof(TriangleIntersect) * triangles.size();
+
+	VkWriteDescriptorSet triIntersectWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &triIntersectBufferInfo, 15);
+
+	VkDescriptorBufferInfo samplerTableBufferInfo;
+	samplerTableBufferInfo.buffer = samplerTableBuffer.buffer;
+	samplerTableBufferInfo.offset = 0;
+	samplerTableBufferInfo.range = sizeof(vkutil::SamplerTables);
+
+	VkWriteDescriptorSet samplerTableWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &samplerTableBufferInfo, 25);
+
+	VkDescriptorBufferInfo workQueueBufferInfo;
+	workQueueBufferInfo.buffer = workQueueBuffer.buffer;
+	workQueueBufferInfo.offset = 0;
+	workQueueBufferInfo.range = sizeof(uint32_t);
+
+	VkWriteDescriptorSet workQueueWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &workQueueBufferInfo, 9);
+
+	VkDescriptorBufferInfo adaptiveBufferInfo;
+	adaptiveBufferInfo.buffer = adaptiveBuffer.buffer;
+	adaptiveBufferInfo.offset = 0;
+	adaptiveBufferInfo.range = sizeof(uint32_t) * (4 + _windowExtent.width * _windowExtent.height);
+
+	VkWriteDescriptorSet adaptiveWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &adaptiveBufferInfo, 28);
+
+	VkDescriptorBufferInfo guideBufferInfo;
+	guideBufferInfo.buffer = guideBuffer.buffer;
+	guideBufferInfo.offset = 0;
+	guideBufferInfo.range = GUIDE_BUFFER_SIZE;
+
+	VkWriteDescriptorSet guideWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &guideBufferInfo, 31);
+
+	VkDescriptorBufferInfo reservoirBufferInfo;
+	reservoirBufferInfo.buffer = reservoirBuffer.buffer;
+	reservoirBufferInfo.offset = 0;
+	reservoirBufferInfo.range = sizeof(ReservoirHeader) + RESERVOIR_SIZE * RESERVOIR_SETS * _windowExtent.width * _windowExtent.height;
+
+	VkWriteDescriptorSet reservoirWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &reservoirBufferInfo, 32);
+
+	VkDescriptorBufferInfo giReservoirBufferInfo;
+	giReservoirBufferInfo.buffer = giReservoirBuffer.buffer;
+	giReservoirBufferInfo.offset = 0;
+	giReservoirBufferInfo.range = sizeof(ReservoirHeader) + GI_RESERVOIR_SIZE * GI_RESERVOIR_SETS * _windowExtent.width * _windowExtent.height;
+
+	VkWriteDescriptorSet giReservoirWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &giReservoirBufferInfo, 33);
+
+	VkDescriptorBufferInfo giPixelBufferInfo;
+	giPixelBufferInfo.buffer = giPixelBuffer.buffer;
+	giPixelBufferInfo.offset = 0;
+	giPixelBufferInfo.range = GI_PIXEL_SIZE * _windowExtent.width * _windowExtent.height;
+
+	VkWriteDescriptorSet giPixelWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &giPixelBufferInfo, 34);
+
+	VkDescriptorBufferInfo wavefrontQueueInfo;
+	wavefrontQueueInfo.buffer = wavefrontQueueBuffer.buffer;
+	wavefrontQueueInfo.offset = 0;
+	wavefrontQueueInfo.range = sizeof(WavefrontQueues);
+
+	VkDescriptorBufferInfo wavefrontItemInfo;
+	wavefrontItemInfo.buffer = wavefrontItemBuffer.buffer;
+	wavefrontItemInfo.offset = 0;
+	wavefrontItemInfo.range = sizeof(uint32_t) * WAVEFRONT_POOL_SIZE * 4;
+
+	VkDescriptorBufferInfo wavefrontPathInfo;
+	wavefrontPathInfo.buffer = wavefrontPathBuffer.buffer;
+	wavefrontPathInfo.offset = 0;
+	wavefrontPathInfo.range = sizeof(WavefrontPath) * WAVEFRONT_POOL_SIZE;
+
+	VkDescriptorBufferInfo wavefrontHitInfo;
+	wavefrontHitInfo.buffer = wavefrontHitBuffer.buffer;
+	wavefrontHitInfo.offset = 0;
+	wavefrontHitInfo.range = sizeof(HitRecord) * WAVEFRONT_POOL_SIZE;
+
+	VkDescriptorBufferInfo wavefrontShadowInfo;
+	wavefrontShadowInfo.buffer = wavefrontShadowBuffer.buffer;
+	wavefrontShadowInfo.offset = 0;
+	wavefrontShadowInfo.range = sizeof(WavefrontShadowRay) * WAVEFRONT_POOL_SIZE;
+
+	VkDescriptorBufferInfo wavefrontSortInfo;
+	wavefrontSortInfo.buffer = wavefrontSortBuffer.buffer;
+	wavefrontSortInfo.offset = 0;
+	wavefrontSortInfo.range = sizeof(uint32_t) * WAVEFRONT_SORT_BUCKETS * 2 + sizeof(glm::uvec2) * WAVEFRONT_POOL_SIZE;
+
+	VkWriteDescriptorSet wavefrontQueueWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &wavefrontQueueInfo, 10);
+	VkWriteDescriptorSet wavefrontItemWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &wavefrontItemInfo, 11);
+	VkWriteDescriptorSet wavefrontPathWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &wavefrontPathInfo, 12);
+	VkWriteDescriptorSet wavefrontHitWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &wavefrontHitInfo, 13);
+	VkWriteDescriptorSet wavefrontShadowWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &wavefrontShadowInfo, 14);
+	VkWriteDescriptorSet wavefrontSortWrite = vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &wavefrontSortInfo, 16);
+
 	VkDescriptorImageInfo samplerImageInfos[2];
 	for (int i = 0; i < 2; i++) {
 		samplerImageInfos[i].sampler = i == 0 ? sampler : clampSampler;
@@ -625,9 +1137,32 @@ void VulkanEngine::update_descriptors() {
 
 	textureWrite.descriptorCount = MAX_TEXTURES;
 	
-	VkWriteDescriptorSet computeWrites[] = {compTex, textureWrite, sphereWrite, materialWrite, triPointWrite, triangleWrite, objectWrite, bvhWrite, samplerSet};
+	std::vector<VkWriteDescriptorSet> computeWrites = {compTex, textureWrite, materialWrite, triPointWrite, triangleWrite, objectWrite, bvhWrite, samplerSet, workQueueWrite,
+		wavefrontQueueWrite, wavefrontItemWrite, wavefrontPathWrite, wavefrontHitWrite, wavefrontShadowWrite, triIntersectWrite, wavefrontSortWrite, primaryHitWrite, samplerTableWrite,
+		accumulationWrite, luminanceM2Write, adaptiveWrite, guideWrite, reservoirWrite,
+		giReservoirWrite, giPixelWrite};
+
+	VkWriteDescriptorSetAccelerationStructureKHR tlasInfo{};
+	tlasInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+	tlasInfo.accelerationStructureCount = 1;
+	tlasInfo.pAccelerationStructures = &tlas.handle;
+
+	if (rayQuerySupported) {
+		VkWriteDescriptorSet tlasWrite{};
+		tlasWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		tlasWrite.pNext = &tlasInfo;
+		tlasWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+		tlasWrite.dstSet = computeSet;
+		tlasWrite.dstBinding = 17;
+		tlasWrite.descriptorCount = 1;
+		computeWrites.push_back(tlasWrite);
+	}
 
-	vkUpdateDescriptorSets(device, 9, computeWrites, 0, nullptr);
+	vkUpdateDescriptorSets(device, computeWrites.size(), computeWrites.data(), 0, nullptr);
+	write_sphere_descriptors();
+	write_view_descriptors();
+	write_light_descriptors();
+	write_environment_descriptors();
 
 	deletionQueue.push_function([=]() {
 		vkDestroySampler(device, sampler, nullptr);
@@ -679,11 +1214,9 @@ void VulkanEngine::cornell_box() {
 
 void VulkanEngine::prepare_storage_buffers() {
 	//spheres
-	spheres.resize(MAX_SPHERES);
-
-	//spheres[0] = {glm::vec3(0.f, 0.1f, -0.3f), 0.4f, 5};
-	//spheres[1] = {glm::vec3(0.5f, 0.1f, 0.f), 0.4f, 2};
-	copy_buffer(sizeof(Sphere) * MAX_SPHERES, sphereBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) spheres.data());
+	//spheres.push_back({glm::vec3(0.f, 0.1f, -0.3f), 0.4f, 5});
+	//spheres.push_back({glm::vec3(0.5f, 0.1f, 0.f), 0.4f, 2});
+	upload_spheres();
 
 	//materials
 	RayMaterial dielectric;
@@ -704,57 +1237,1061 @@ void VulkanEngine::prepare_storage_buffers() {
 	RayMaterial blue;
 	blue.albedo = glm::vec3(0.f, 0.f, 1.f);
 
-	RayMaterial li;
-	li.emissionColor = glm::vec3(1.f, 1.f, 1.f);
-	li.albedo = glm::vec3(0.f);
-	li.emissionStrength = 2.4f;
+	RayMaterial li;
+	li.emissionColor = glm::vec3(1.f, 1.f, 1.f);
+	li.albedo = glm::vec3(0.f);
+	li.emissionStrength = 2.4f;
+
+	RayMaterial object;
+	object.albedoIndex = -1;
+	object.metalnessIndex = -1;
+	//object.ior = 1.5f;
+
+	rayMaterials.push_back(white);
+	rayMaterials.push_back(red);
+	rayMaterials.push_back(green);
+	rayMaterials.push_back(li);
+	rayMaterials.push_back(mirror);
+	rayMaterials.push_back(dielectric);
+	// rayMaterials.push_back(object);
+
+	//ccw
+	ImGuiObject model;
+	model.name = "sponza";
+	model.scale = glm::vec3(1.f);
+	//read_obj("../assets/sponza2/sponza_tri.obj", model, 0);
+
+	model.name = "cube";
+	model.scale = glm::vec3(0.25f);
+	model.samplerIndex = 1;
+	model.rotation = glm::vec3(0.f, -30.f, 0.f);
+	model.position = glm::vec3(-0.4f, 0.25f, -0.45f);
+	read_obj("../assets/cube.obj", model, 0);
+
+	model.name = "cube2";
+	model.scale = glm::vec3(0.3f, 0.7f, 0.3f);
+	model.samplerIndex = 1;
+	model.rotation = glm::vec3(0.f, 30.f, 0.f);
+	model.position = glm::vec3(0.4f, -0.2f, 0.45f);
+	read_obj("../assets/cube.obj", model, 0);
+
+	model.name = "bunny";
+	model.scale = glm::vec3(0.7f);
+	model.samplerIndex = 1;
+	model.position = glm::vec3(0.f, 0.53f, 0.f);
+	//read_obj("../assets/bunny_full.obj", model, 5);
+
+	cornell_box();
+
+	copy_buffer(sizeof(RayMaterial) * rayMaterials.size(), materialBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) rayMaterials.data());
+	layout_bvh_cache();
+	update_object_meshes();
+
+	VkBufferUsageFlags accelInput = rayQuerySupported ? VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR : 0;
+	copy_buffer(sizeof(TrianglePoint) * triPoints.size(), triPointBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | accelInput, (void*) triPoints.data());
+	copy_buffer(sizeof(Triangle) * triangles.size(), triangleBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) triangles.data());
+	copy_buffer(sizeof(RenderObject) * objects.size(), objectBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) objects.data());
+	copy_buffer(sizeof(BVHNode) * bvhNodes.size(), bvhBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) bvhNodes.data());
+
+	//triangles are already in leaf order after the bvh builds, so traversal reads one record per candidate
+	std::vector<TriangleIntersect> triIntersects(triangles.size());
+	for (size_t i = 0; i < triangles.size(); i++) {
+		glm::vec3 v0 = triPoints[triangles[i].v0].position;
+		glm::vec3 v1 = triPoints[triangles[i].v1].position;
+		glm::vec3 v2 = triPoints[triangles[i].v2].position;
+		triIntersects[i].v0 = glm::vec4(v0, triangles[i].frontOnly ? 1.f : 0.f);
+		triIntersects[i].edge1 = glm::vec4(v1 - v0, 0.f);
+		triIntersects[i].edge2 = glm::vec4(v2 - v0, 0.f);
+	}
+	copy_buffer(sizeof(TriangleIntersect) * triIntersects.size(), triIntersectBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) triIntersects.data());
+	upload_lights();
+
+	//sobol matrices and the blue noise mask never change
+	vkutil::SamplerTables samplerTables;
+	vkutil::build_sampler_tables(samplerTables);
+	copy_buffer(sizeof(vkutil::SamplerTables), samplerTableBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) &samplerTables);
+
+	//the environment map is optional, without the file the analytic sky is lit as before
+	load_environment_map(environmentMapFile);
+	upload_environment_map();
+
+	cout << "BVH Build Time (all meshes): " << bvhBuildTime << "ms\n";
+	if (rayQuerySupported) build_acceleration_structures();
+
+	//persistent threads work queue, reset every dispatch
+	workQueueBuffer = create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	deletionQueue.push_function([=]() {
+		vmaDestroyBuffer(allocator, workQueueBuffer.buffer, workQueueBuffer.allocation);
+	});
+
+	//adaptive sampling, the header doubles as the megakernel's indirect args
+	size_t adaptiveSize = sizeof(uint32_t) * (4 + _windowExtent.width * _windowExtent.height);
+	adaptiveBuffer = create_buffer(adaptiveSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	adaptiveStatsBuffer = create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+	deletionQueue.push_function([=]() {
+		vmaDestroyBuffer(allocator, adaptiveBuffer.buffer, adaptiveBuffer.allocation);
+		vmaDestroyBuffer(allocator, adaptiveStatsBuffer.buffer, adaptiveStatsBuffer.allocation);
+	});
+
+	//path guiding cache, cleared by run_compute before its first use
+	guideBuffer = create_buffer(GUIDE_BUFFER_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	guideStatsBuffer = create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+	deletionQueue.push_function([=]() {
+		vmaDestroyBuffer(allocator, guideBuffer.buffer, guideBuffer.allocation);
+		vmaDestroyBuffer(allocator, guideStatsBuffer.buffer, guideStatsBuffer.allocation);
+	});
+
+	//restir reservoirs, the header is written every frame so the contents never need clearing
+	size_t reservoirSize = sizeof(ReservoirHeader) + RESERVOIR_SIZE * RESERVOIR_SETS * _windowExtent.width * _windowExtent.height;
+	reservoirBuffer = create_buffer(reservoirSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	deletionQueue.push_function([=]() {
+		vmaDestroyBuffer(allocator, reservoirBuffer.buffer, reservoirBuffer.allocation);
+	});
+
+	//restir gi reservoirs and the megakernel's pixels, both fully rewritten every frame they are used
+	size_t giReservoirSize = sizeof(ReservoirHeader) + GI_RESERVOIR_SIZE * GI_RESERVOIR_SETS * _windowExtent.width * _windowExtent.height;
+	giReservoirBuffer = create_buffer(giReservoirSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	giPixelBuffer = create_buffer(GI_PIXEL_SIZE * _windowExtent.width * _windowExtent.height, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	deletionQueue.push_function([=]() {
+		vmaDestroyBuffer(allocator, giReservoirBuffer.buffer, giReservoirBuffer.allocation);
+		vmaDestroyBuffer(allocator, giPixelBuffer.buffer, giPixelBuffer.allocation);
+	});
+
+	//wavefront path pool, queue headers double as indirect dispatch args
+	VkBufferUsageFlags wavefrontUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	wavefrontQueueBuffer = create_buffer(sizeof(WavefrontQueues), wavefrontUsage | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	wavefrontItemBuffer = create_buffer(sizeof(uint32_t) * WAVEFRONT_POOL_SIZE * 4, wavefrontUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+	wavefrontPathBuffer = create_buffer(sizeof(WavefrontPath) * WAVEFRONT_POOL_SIZE, wavefrontUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+	wavefrontHitBuffer = create_buffer(sizeof(HitRecord) * WAVEFRONT_POOL_SIZE, wavefrontUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+	wavefrontShadowBuffer = create_buffer(sizeof(WavefrontShadowRay) * WAVEFRONT_POOL_SIZE, wavefrontUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+	wavefrontSortBuffer = create_buffer(sizeof(uint32_t) * WAVEFRONT_SORT_BUCKETS * 2 + sizeof(glm::uvec2) * WAVEFRONT_POOL_SIZE, wavefrontUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+	wavefrontStatsBuffer = create_buffer(sizeof(uint32_t) * WAVEFRONT_STAGES, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+	deletionQueue.push_function([=]() {
+		vmaDestroyBuffer(allocator, wavefrontQueueBuffer.buffer, wavefrontQueueBuffer.allocation);
+		vmaDestroyBuffer(allocator, wavefrontItemBuffer.buffer, wavefrontItemBuffer.allocation);
+		vmaDestroyBuffer(allocator, wavefrontPathBuffer.buffer, wavefrontPathBuffer.allocation);
+		vmaDestroyBuffer(allocator, wavefrontHitBuffer.buffer, wavefrontHitBuffer.allocation);
+		vmaDestroyBuffer(allocator, wavefrontShadowBuffer.buffer, wavefrontShadowBuffer.allocation);
+		vmaDestroyBuffer(allocator, wavefrontSortBuffer.buffer, wavefrontSortBuffer.allocation);
+		vmaDestroyBuffer(allocator, wavefrontStatsBuffer.buffer, wavefrontStatsBuffer.allocation);
+	});
+}
+
+//one blas per bvh mesh built from the same vertices and leaf ordered triangles, then a tlas over the objects
+void VulkanEngine::build_acceleration_structures() {
+	auto start = std::chrono::system_clock::now();
+
+	std::vector<uint32_t> indices(triangles.size() * 3);
+	for (size_t i = 0; i < triangles.size(); i++) {
+		indices[i * 3] = triangles[i].v0;
+		indices[i * 3 + 1] = triangles[i].v1;
+		indices[i * 3 + 2] = triangles[i].v2;
+	}
+	copy_buffer(sizeof(uint32_t) * indices.size(), rqIndexBuffer, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, indices.data());
+
+	VkDeviceAddress vertexAddress = buffer_address(triPointBuffer.buffer);
+	VkDeviceAddress indexAddress = buffer_address(rqIndexBuffer.buffer);
+
+	size_t meshCount = bvhMeshes.size();
+	std::vector<VkAccelerationStructureGeometryKHR> geometries(meshCount);
+	std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(meshCount);
+	std::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges(meshCount);
+	std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangePointers(meshCount);
+	std::vector<VkDeviceSize> scratchOffsets(meshCount);
+	VkDeviceSize scratchSize = 0;
+	blases.resize(meshCount);
+
+	for (size_t i = 0; i < meshCount; i++) {
+		BVHMesh mesh = bvhMeshes[i];
+
+		//front only triangles have to come back as candidates so the shader can drop their back faces
+		bool opaque = true;
+		for (uint j = mesh.triOffset; j < mesh.triOffset + mesh.triCount; j++) {
+			opaque &= !triangles[j].frontOnly;
+		}
+
+		VkAccelerationStructureGeometryKHR& geometry = geometries[i];
+		geometry = {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
+		geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+		geometry.flags = opaque ? VK_GEOMETRY_OPAQUE_BIT_KHR : 0;
+		geometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+		geometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+		geometry.geometry.triangles.vertexData.deviceAddress = vertexAddress;
+		geometry.geometry.triangles.vertexStride = sizeof(TrianglePoint);
+		geometry.geometry.triangles.maxVertex = triPoints.size() - 1;
+		geometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
+		geometry.geometry.triangles.indexData.deviceAddress = indexAddress;
+
+		ranges[i] = {};
+		ranges[i].primitiveCount = mesh.triCount;
+		ranges[i].primitiveOffset = mesh.triOffset * 3 * sizeof(uint32_t);
+		rangePointers[i] = &ranges[i];
+
+		VkAccelerationStructureBuildGeometryInfoKHR& buildInfo = buildInfos[i];
+		buildInfo = {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+		buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+		buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+		buildInfo.geometryCount = 1;
+		buildInfo.pGeometries = &geometry;
+
+		VkAccelerationStructureBuildSizesInfoKHR sizeInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+		vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, &mesh.triCount, &sizeInfo);
+
+		blases[i] = create_acceleration_structure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, sizeInfo.accelerationStructureSize);
+		buildInfo.dstAccelerationStructure = blases[i].handle;
+		scratchOffsets[i] = scratchSize;
+		scratchSize += (sizeInfo.buildScratchSize + scratchAlignment - 1) / scratchAlignment * scratchAlignment;
+	}
+
+	//every blas builds in one submit out of a shared scratch buffer
+	AllocatedBuffer scratch = create_buffer(scratchSize + scratchAlignment, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	VkDeviceAddress scratchAddress = (buffer_address(scratch.buffer) + scratchAlignment - 1) / scratchAlignment * scratchAlignment;
+	for (size_t i = 0; i < meshCount; i++) {
+		buildInfos[i].scratchData.deviceAddress = scratchAddress + scratchOffsets[i];
+	}
+
+	immediate_submit([&](VkCommandBuffer cmd) {
+		vkCmdBuildAccelerationStructuresKHR(cmd, meshCount, buildInfos.data(), rangePointers.data());
+	});
+	vmaDestroyBuffer(allocator, scratch.buffer, scratch.allocation);
+
+	build_tlas();
+
+	auto end = std::chrono::system_clock::now();
+	accelBuildTime = std::chrono::duration<float, std::milli>(end - start).count();
+	cout << "Acceleration Structure Build Time: " << accelBuildTime << "ms\n";
+	cout << "BLAS Count: " << meshCount << endl;
+}
+
+//traces the current frame with both megakernels over the same scene and reports them next to their build times.
+//the builds are the ones timed at load, the frame reuses the last push constants and accumulation restarts afterwards
+void VulkanEngine::run_backend_benchmark(uint frames) {
+	if (rayQueryModule == VK_NULL_HANDLE) return;
+
+	VkPipeline backends[2] = {megakernel_variant(false), megakernel_variant(true)};
+	glm::uvec2 groupSize = megakernelGroupShapes[groupShape];
+	const char* scopes[2] = {"software bvh trace", "ray query trace"};
+
+	//both backends trace their own camera rays, a cached primary hit would hide half the traversal
+	PushConstants bench = constants;
+	bench.primaryHitMode = PRIMARY_HITS_OFF;
+	for (int i = 0; i < 2; i++) {
+		auto start = std::chrono::system_clock::now();
+		immediate_submit([&](VkCommandBuffer cmd) {
+			profiler.reset(cmd);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeLayout, 0, 1, &computeSet, 0, nullptr);
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, backends[i]);
+			vkCmdPushConstants(cmd, computePipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &bench);
+			int scope = profiler.begin(cmd, scopes[i]);
+			for (uint frame = 0; frame < frames; frame++) {
+				vkCmdDispatch(cmd, (_windowExtent.width + groupSize.x - 1) / groupSize.x, (_windowExtent.height + groupSize.y - 1) / groupSize.y, 1);
+				compute_barrier(cmd);
+			}
+			profiler.end(cmd, scope);
+		});
+		auto end = std::chrono::system_clock::now();
+		profiler.resolve(device);
+
+		//without timestamps the submission to fence time is the best there is
+		float total = profiler.supported ? profiler.get(scopes[i]) : std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
+		backendTraceTimes[i] = total / frames;
+	}
+	_frameNumber = 0;
+
+	cout << "Backend comparison (" << _windowExtent.width << "x" << _windowExtent.height << ", " << frames << " frames, " << (profiler.supported ? "gpu" : "host") << "):\n";
+	cout << "  software bvh: build " << bvhBuildTime << "ms, trace " << backendTraceTimes[0] << "ms/frame\n";
+	cout << "  ray query:    build " << accelBuildTime << "ms, trace " << backendTraceTimes[1] << "ms/frame\n";
+}
+
+//rebuilt from scratch whenever the object transforms change, the instance count never does
+void VulkanEngine::build_tlas() {
+	std::vector<VkAccelerationStructureInstanceKHR> instances(objects.size());
+	for (size_t i = 0; i < objects.size(); i++) {
+		glm::mat4 transform = glm::transpose(objects[i].transformMatrix);
+		memcpy(&instances[i].transform, &transform, sizeof(VkTransformMatrixKHR));
+		instances[i].instanceCustomIndex = i;
+		instances[i].mask = 0xFF;
+		instances[i].instanceShaderBindingTableRecordOffset = 0;
+		instances[i].flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+		for (size_t j = 0; j < bvhMeshes.size(); j++) {
+			if (bvhMeshes[j].rootIndex == objects[i].bvhIndex) instances[i].accelerationStructureReference = blases[j].address;
+		}
+	}
+
+	bool firstBuild = tlas.handle == VK_NULL_HANDLE;
+	if (firstBuild) {
+		tlasInstanceBuffer = create_buffer(sizeof(VkAccelerationStructureInstanceKHR) * instances.size(),
+			VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		deletionQueue.push_function([=]() {
+			vmaDestroyBuffer(allocator, tlasInstanceBuffer.buffer, tlasInstanceBuffer.allocation);
+		});
+	}
+	update_buffer(sizeof(VkAccelerationStructureInstanceKHR) * instances.size(), tlasInstanceBuffer, instances.data());
+
+	VkAccelerationStructureGeometryKHR geometry{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
+	geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+	geometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+	geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+	geometry.geometry.instances.data.deviceAddress = buffer_address(tlasInstanceBuffer.buffer);
+
+	VkAccelerationStructureBuildGeometryInfoKHR buildInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+	buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+	buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+	buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+	buildInfo.geometryCount = 1;
+	buildInfo.pGeometries = &geometry;
+
+	uint32_t instanceCount = instances.size();
+	if (firstBuild) {
+		VkAccelerationStructureBuildSizesInfoKHR sizeInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+		vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, &instanceCount, &sizeInfo);
+
+		tlas = create_acceleration_structure(VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, sizeInfo.accelerationStructureSize);
+		tlasScratchBuffer = create_buffer(sizeInfo.buildScratchSize + scratchAlignment, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		deletionQueue.push_function([=]() {
+			vmaDestroyBuffer(allocator, tlasScratchBuffer.buffer, tlasScratchBuffer.allocation);
+		});
+	}
+	buildInfo.dstAccelerationStructure = tlas.handle;
+	buildInfo.scratchData.deviceAddress = (buffer_address(tlasScratchBuffer.buffer) + scratchAlignment - 1) / scratchAlignment * scratchAlignment;
+
+	VkAccelerationStructureBuildRangeInfoKHR range{};
+	range.primitiveCount = instanceCount;
+	const VkAccelerationStructureBuildRangeInfoKHR* rangePointer = &range;
+
+	immediate_submit([&](VkCommandBuffer cmd) {
+		vkCmdBuildAccelerationStructuresKHR(cmd, 1, &buildInfo, &rangePointer);
+	});
+}
+
+AccelerationStructure VulkanEngine::create_acceleration_structure(VkAccelerationStructureTypeKHR type, VkDeviceSize size) {
+	AccelerationStructure accel;
+	accel.buffer = create_buffer(size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+	VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+	createInfo.buffer = accel.buffer.buffer;
+	createInfo.size = size;
+	createInfo.type = type;
+	VK_CHECK(vkCreateAccelerationStructureKHR(device, &createInfo, nullptr, &accel.handle));
+
+	VkAccelerationStructureDeviceAddressInfoKHR addressInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR};
+	addressInfo.accelerationStructure = accel.handle;
+	accel.address = vkGetAccelerationStructureDeviceAddressKHR(device, &addressInfo);
+
+	deletionQueue.push_function([=]() {
+		vkDestroyAccelerationStructureKHR(device, accel.handle, nullptr);
+		vmaDestroyBuffer(allocator, accel.buffer.buffer, accel.buffer.allocation);
+	});
+	return accel;
+}
+
+VkDeviceAddress VulkanEngine::buffer_address(VkBuffer buffer) {
+	VkBufferDeviceAddressInfo addressInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
+	addressInfo.buffer = buffer;
+	return vkGetBufferDeviceAddressKHR(device, &addressInfo);
+}
+
+//median split on the longest centroid axis, cheap enough to redo on every sphere edit
+void VulkanEngine::build_sphere_bvh() {
+	auto start = std::chrono::system_clock::now();
+
+	orderedSpheres = spheres;
+	sphereNodes.clear();
+	sphereNodes.push_back({});
+	sphereNodes[0].triCount = orderedSpheres.size();
+
+	std::vector<uint> stack = {0};
+	while (!stack.empty()) {
+		uint nodeIndex = stack.back();
+		stack.pop_back();
+		uint first = sphereNodes[nodeIndex].index;
+		uint count = sphereNodes[nodeIndex].triCount;
+
+		glm::vec3 boxMin(1e30f), boxMax(-1e30f), centroidMin(1e30f), centroidMax(-1e30f);
+		for (uint i = first; i < first + count; i++) {
+			Sphere& sphere = orderedSpheres[i];
+			boxMin = glm::min(boxMin, sphere.position - sphere.radius);
+			boxMax = glm::max(boxMax, sphere.position + sphere.radius);
+			centroidMin = glm::min(centroidMin, sphere.position);
+			centroidMax = glm::max(centroidMax, sphere.position);
+		}
+
+		BVHNode& node = sphereNodes[nodeIndex];
+		node.boundsX = {boxMin.x, boxMax.x};
+		node.boundsY = {boxMin.y, boxMax.y};
+		node.boundsZ = {boxMin.z, boxMax.z};
+		if (count <= SPHERE_LEAF_SIZE) continue;
+
+		glm::vec3 extent = centroidMax - centroidMin;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		uint mid = first + count / 2;
+		std::nth_element(orderedSpheres.begin() + first, orderedSpheres.begin() + mid, orderedSpheres.begin() + first + count, [axis](const Sphere& a, const Sphere& b) {
+			return a.position[axis] < b.position[axis];
+		});
+
+		uint children = sphereNodes.size();
+		node.index = children;
+		node.triCount = 0;
+
+		BVHNode left, right;
+		left.index = first;
+		left.triCount = mid - first;
+		right.index = mid;
+		right.triCount = first + count - mid;
+		sphereNodes.push_back(left);
+		sphereNodes.push_back(right);
+		stack.push_back(children);
+		stack.push_back(children + 1);
+	}
+
+	auto end = std::chrono::system_clock::now();
+	auto time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+	cout << "Sphere BVH Build Time: " << time.count() << "ms (" << orderedSpheres.size() << " spheres, " << sphereNodes.size() << " nodes)\n";
+}
+
+//the sphere buffers only grow, they are reallocated (and rebound) when the sphere count outgrows them
+void VulkanEngine::upload_spheres() {
+	build_sphere_bvh();
+
+	if (orderedSpheres.size() > sphereCapacity || sphereCapacity == 0) {
+		bool firstAllocation = sphereCapacity == 0;
+		if (!firstAllocation) {
+			vkDeviceWaitIdle(device);
+			vmaDestroyBuffer(allocator, sphereBuffer.buffer, sphereBuffer.allocation);
+			vmaDestroyBuffer(allocator, sphereBvhBuffer.buffer, sphereBvhBuffer.allocation);
+		}
+
+		sphereCapacity = std::max<size_t>(std::max<size_t>(orderedSpheres.size(), sphereCapacity * 2), 16);
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		sphereBuffer = create_buffer(sizeof(Sphere) * sphereCapacity, usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		sphereBvhBuffer = create_buffer(sizeof(BVHNode) * sphereCapacity * 2, usage, VMA_MEMORY_USAGE_GPU_ONLY);
+
+		if (firstAllocation) {
+			deletionQueue.push_function([=]() {
+				vmaDestroyBuffer(allocator, sphereBuffer.buffer, sphereBuffer.allocation);
+				vmaDestroyBuffer(allocator, sphereBvhBuffer.buffer, sphereBvhBuffer.allocation);
+			});
+		} else {
+			write_sphere_descriptors();
+		}
+	}
+
+	if (!orderedSpheres.empty()) update_buffer(sizeof(Sphere) * orderedSpheres.size(), sphereBuffer, orderedSpheres.data());
+	update_buffer(sizeof(BVHNode) * sphereNodes.size(), sphereBvhBuffer, sphereNodes.data());
+}
+
+void VulkanEngine::write_sphere_descriptors() {
+	VkDescriptorBufferInfo sphereBufferInfo;
+	sphereBufferInfo.buffer = sphereBuffer.buffer;
+	sphereBufferInfo.offset = 0;
+	sphereBufferInfo.range = sizeof(Sphere) * sphereCapacity;
+
+	VkDescriptorBufferInfo sphereBvhBufferInfo;
+	sphereBvhBufferInfo.buffer = sphereBvhBuffer.buffer;
+	sphereBvhBufferInfo.offset = 0;
+	sphereBvhBufferInfo.range = sizeof(BVHNode) * sphereCapacity * 2;
+
+	VkWriteDescriptorSet sphereWrites[] = {
+		vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &sphereBufferInfo, 2),
+		vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &sphereBvhBufferInfo, 18)
+	};
+	vkUpdateDescriptorSets(device, std::size(sphereWrites), sphereWrites, 0, nullptr);
+}
+
+//smallest cone holding two normal cones, from conty and kulla's light tree
+static void merge_light_cones(glm::vec3 axisA, float cosA, glm::vec3 axisB, float cosB, glm::vec3& axis, float& cosTheta) {
+	float thetaA = std::acos(glm::clamp(cosA, -1.f, 1.f));
+	float thetaB = std::acos(glm::clamp(cosB, -1.f, 1.f));
+	if (thetaB > thetaA) {
+		std::swap(axisA, axisB);
+		std::swap(thetaA, thetaB);
+	}
+
+	axis = axisA;
+	cosTheta = -1.f;
+	if (thetaA >= glm::pi<float>()) return;
+
+	float thetaD = std::acos(glm::clamp(glm::dot(axisA, axisB), -1.f, 1.f));
+	if (std::min(thetaD + thetaB, glm::pi<float>()) <= thetaA) {
+		cosTheta = std::cos(thetaA);
+		return;
+	}
+
+	float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+	glm::vec3 rotationAxis = glm::cross(axisA, axisB);
+	if (thetaO >= glm::pi<float>() || glm::length(rotationAxis) < 1e-6f) return;
+
+	//rotate a towards b until the new cone touches both
+	rotationAxis = glm::normalize(rotationAxis);
+	float thetaR = thetaO - thetaA;
+	axis = axisA * std::cos(thetaR) + glm::cross(rotationAxis, axisA) * std::sin(thetaR);
+	cosTheta = std::cos(thetaO);
+}
+
+//median split on the longest centroid axis down to one light per leaf, lights[order[first..]] are under node
+void VulkanEngine::build_light_tree(uint node, uint first, uint count, std::vector<uint>& order, std::vector<glm::vec3>& centers, uint& nodesUsed) {
+	LightNode result;
+	result.first = first;
+	result.count = count;
+
+	if (count == 1) {
+		LightSource& light = lights[order[first]];
+		if (light.shape == LIGHT_SPHERE) {
+			result.boundsMin = light.v0 - glm::vec3(light.edge1.x);
+			result.boundsMax = light.v0 + glm::vec3(light.edge1.x);
+		} else {
+			glm::vec3 v1 = light.v0 + light.edge1;
+			glm::vec3 v2 = light.v0 + light.edge2;
+			result.boundsMin = glm::min(light.v0, glm::min(v1, v2));
+			result.boundsMax = glm::max(light.v0, glm::max(v1, v2));
+		}
+		result.power = light.selectPDF * lightPower;
+		result.axis = light.normal;
+		result.cosTheta = light.shape == LIGHT_TRIANGLE_FRONT ? 1.f : -1.f;
+		lightNodes[node] = result;
+		return;
+	}
+
+	glm::vec3 centerMin = glm::vec3(1e30f);
+	glm::vec3 centerMax = glm::vec3(-1e30f);
+	for (uint i = first; i < first + count; i++) {
+		centerMin = glm::min(centerMin, centers[order[i]]);
+		centerMax = glm::max(centerMax, centers[order[i]]);
+	}
+	glm::vec3 extent = centerMax - centerMin;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+	uint leftCount = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + leftCount, order.begin() + first + count, [&](uint a, uint b) {
+		return centers[a][axis] < centers[b][axis];
+	});
+
+	result.child = nodesUsed;
+	nodesUsed += 2;
+	build_light_tree(result.child, first, leftCount, order, centers, nodesUsed);
+	build_light_tree(result.child + 1, first + leftCount, count - leftCount, order, centers, nodesUsed);
+
+	LightNode& left = lightNodes[result.child];
+	LightNode& right = lightNodes[result.child + 1];
+	result.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+	result.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+	result.power = left.power + right.power;
+	merge_light_cones(left.axis, left.cosTheta, right.axis, right.cosTheta, result.axis, result.cosTheta);
+	lightNodes[node] = result;
+}
+
+//every triangle of an emissive object and every emissive sphere becomes a light. they are picked by the light tree,
+//or in proportion to their power with a vose alias table
+void VulkanEngine::build_light_list() {
+	auto start = std::chrono::system_clock::now();
+	lights.clear();
+	lightSlots.clear();
+	lightPower = 0.f;
+
+	//keys are what a hit knows about itself, see lightSlots
+	std::vector<float> powers;
+	std::vector<glm::vec3> centers;
+	for (Sphere& sphere : orderedSpheres) {
+		RayMaterial material = rayMaterials[sphere.materialIndex];
+		glm::vec3 emission = material.emissionColor * material.emissionStrength;
+		float luminance = glm::dot(emission, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+		if (material.emissionStrength <= 0.f || luminance <= 0.f || sphere.radius <= 0.f) {
+			lightSlots.push_back(NO_LIGHT);
+			continue;
+		}
+
+		LightSource light;
+		light.v0 = sphere.position;
+		light.edge1 = glm::vec3(sphere.radius, 0.f, 0.f);
+		light.edge2 = glm::vec3(0.f);
+		light.area = 4.f * glm::pi<float>() * sphere.radius * sphere.radius;
+		light.emission = emission;
+		light.normal = glm::vec3(0.f, 1.f, 0.f);
+		light.shape = LIGHT_SPHERE;
+		lightSlots.push_back(lights.size());
+		lights.push_back(light);
+		powers.push_back(luminance * light.area);
+		centers.push_back(sphere.position);
+	}
+
+	for (RenderObject& object : objects) {
+		RayMaterial material = rayMaterials[object.materialIndex];
+		glm::vec3 emission = material.emissionColor * material.emissionStrength;
+		float luminance = glm::dot(emission, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+		if (material.emissionStrength <= 0.f || luminance <= 0.f) continue;
+
+		BVHMesh* mesh = nullptr;
+		for (BVHMesh& candidate : bvhMeshes) {
+			if (candidate.rootIndex == object.bvhIndex) mesh = &candidate;
+		}
+		if (mesh == nullptr) continue;
+
+		//a mirroring transform flips the winding, keep the normal on the side triangleHit calls front
+		object.lightOffset = lightSlots.size();
+		float handedness = glm::determinant(glm::mat3(object.transformMatrix)) < 0.f ? -1.f : 1.f;
+		for (uint i = mesh->triOffset; i < mesh->triOffset + mesh->triCount; i++) {
+			glm::vec3 v0 = object.transformMatrix * glm::vec4(glm::vec3(triPoints[triangles[i].v0].position), 1.f);
+			glm::vec3 v1 = object.transformMatrix * glm::vec4(glm::vec3(triPoints[triangles[i].v1].position), 1.f);
+			glm::vec3 v2 = object.transformMatrix * glm::vec4(glm::vec3(triPoints[triangles[i].v2].position), 1.f);
+			glm::vec3 normal = glm::cross(v1 - v0, v2 - v0);
+			float area = glm::length(normal) * 0.5f;
+			if (area <= 0.f) {
+				lightSlots.push_back(NO_LIGHT);
+				continue;
+			}
+
+			LightSource light;
+			light.v0 = v0;
+			light.edge1 = v1 - v0;
+			light.edge2 = v2 - v0;
+			light.area = area;
+			light.emission = emission;
+			light.normal = normal / (area * 2.f) * handedness;
+			light.shape = triangles[i].frontOnly ? LIGHT_TRIANGLE_FRONT : LIGHT_TRIANGLE;
+			lightSlots.push_back(lights.size());
+			lights.push_back(light);
+			powers.push_back(luminance * area);
+			centers.push_back((v0 + v1 + v2) / 3.f);
+		}
+	}
+
+	size_t count = lights.size();
+	for (size_t i = 0; i < count; i++) lightPower += powers[i];
+	for (size_t i = 0; i < count; i++) lights[i].selectPDF = powers[i] / lightPower;
+
+	//build the tree, then store the lights in its leaf order so every node covers a contiguous range
+	lightNodes.assign(std::max<size_t>(count * 2, 2) - 1, LightNode());
+	if (count > 0) {
+		std::vector<uint> order(count);
+		for (uint i = 0; i < count; i++) order[i] = i;
+		uint nodesUsed = 1;
+		build_light_tree(0, 0, count, order, centers, nodesUsed);
+
+		std::vector<LightSource> built = lights;
+		std::vector<uint> position(count);
+		for (uint i = 0; i < count; i++) {
+			lights[i] = built[order[i]];
+			position[order[i]] = i;
+		}
+		for (uint& slot : lightSlots) {
+			if (slot != NO_LIGHT) slot = position[slot];
+		}
+	}
+
+	//scale powers to a mean of 1, then pair each underfull entry with an overfull one
+	std::vector<float> scaled(count);
+	std::vector<uint> small, large;
+	for (size_t i = 0; i < count; i++) {
+		lights[i].alias = i;
+		scaled[i] = lights[i].selectPDF * count;
+		if (scaled[i] < 1.f) small.push_back(i);
+		else large.push_back(i);
+	}
+
+	while (!small.empty() && !large.empty()) {
+		uint under = small.back();
+		small.pop_back();
+		uint over = large.back();
+		large.pop_back();
+
+		lights[under].aliasProbability = scaled[under];
+		lights[under].alias = over;
+		scaled[over] = scaled[over] + scaled[under] - 1.f;
+		if (scaled[over] < 1.f) small.push_back(over);
+		else large.push_back(over);
+	}
+
+	//whatever is left is 1 up to rounding
+	for (uint i : small) lights[i].aliasProbability = 1.f;
+	for (uint i : large) lights[i].aliasProbability = 1.f;
+
+	auto end = std::chrono::system_clock::now();
+	auto time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+	cout << "Light Tree Build Time: " << time.count() << "ms (" << count << " lights, " << lightNodes.size() << " nodes)\n";
+}
+
+//same growth scheme as the sphere buffers. objects are re-uploaded for their lightOffset
+void VulkanEngine::upload_lights() {
+	build_light_list();
+
+	bool firstAllocation = lightCapacity == 0;
+	bool grown = false;
+	if (lights.size() > lightCapacity || firstAllocation) {
+		if (!firstAllocation) {
+			vkDeviceWaitIdle(device);
+			vmaDestroyBuffer(allocator, lightBuffer.buffer, lightBuffer.allocation);
+			vmaDestroyBuffer(allocator, lightTreeBuffer.buffer, lightTreeBuffer.allocation);
+		}
+
+		lightCapacity = std::max<size_t>(std::max<size_t>(lights.size(), lightCapacity * 2), 16);
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		lightBuffer = create_buffer(sizeof(LightSource) * lightCapacity, usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		lightTreeBuffer = create_buffer(sizeof(LightNode) * lightCapacity * 2, usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		grown = true;
+	}
+
+	if (lightSlots.size() > lightSlotCapacity || firstAllocation) {
+		if (!firstAllocation) {
+			vkDeviceWaitIdle(device);
+			vmaDestroyBuffer(allocator, lightSlotBuffer.buffer, lightSlotBuffer.allocation);
+		}
+
+		lightSlotCapacity = std::max<size_t>(std::max<size_t>(lightSlots.size(), lightSlotCapacity * 2), 16);
+		lightSlotBuffer = create_buffer(sizeof(uint) * lightSlotCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		grown = true;
+	}
+
+	if (firstAllocation) {
+		deletionQueue.push_function([=]() {
+			vmaDestroyBuffer(allocator, lightBuffer.buffer, lightBuffer.allocation);
+			vmaDestroyBuffer(allocator, lightTreeBuffer.buffer, lightTreeBuffer.allocation);
+			vmaDestroyBuffer(allocator, lightSlotBuffer.buffer, lightSlotBuffer.allocation);
+		});
+	} else if (grown) {
+		write_light_descriptors();
+	}
+
+	if (!lights.empty()) {
+		update_buffer(sizeof(LightSource) * lights.size(), lightBuffer, lights.data());
+		update_buffer(sizeof(LightNode) * lightNodes.size(), lightTreeBuffer, lightNodes.data());
+	}
+	if (!lightSlots.empty()) update_buffer(sizeof(uint) * lightSlots.size(), lightSlotBuffer, lightSlots.data());
+	update_buffer(sizeof(RenderObject) * objects.size(), objectBuffer, objects.data());
+}
+
+void VulkanEngine::write_light_descriptors() {
+	VkDescriptorBufferInfo lightBufferInfo;
+	lightBufferInfo.buffer = lightBuffer.buffer;
+	lightBufferInfo.offset = 0;
+	lightBufferInfo.range = sizeof(LightSource) * lightCapacity;
+
+	VkDescriptorBufferInfo lightTreeBufferInfo;
+	lightTreeBufferInfo.buffer = lightTreeBuffer.buffer;
+	lightTreeBufferInfo.offset = 0;
+	lightTreeBufferInfo.range = sizeof(LightNode) * lightCapacity * 2;
+
+	VkDescriptorBufferInfo lightSlotBufferInfo;
+	lightSlotBufferInfo.buffer = lightSlotBuffer.buffer;
+	lightSlotBufferInfo.offset = 0;
+	lightSlotBufferInfo.range = sizeof(uint) * lightSlotCapacity;
+
+	VkWriteDescriptorSet lightWrites[] = {
+		vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &lightBufferInfo, 22),
+		vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &lightTreeBufferInfo, 23),
+		vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &lightSlotBufferInfo, 24)
+	};
+	vkUpdateDescriptorSets(device, std::size(lightWrites), lightWrites, 0, nullptr);
+}
+
+//equirectangular hdr, the top row looks up (-y). builds the marginal and conditional cdfs sampleEnvironment inverts
+bool VulkanEngine::load_environment_map(const char* file) {
+	int width, height, channels;
+	float* pixels = stbi_loadf(file, &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels) {
+		cout << "Failed to load environment map " << file << endl;
+		return false;
+	}
+
+	auto start = std::chrono::system_clock::now();
+	environmentMap.width = width;
+	environmentMap.height = height;
+	environmentTexels.assign((glm::vec4*) pixels, (glm::vec4*) pixels + width * height);
+	stbi_image_free(pixels);
+
+	//texels are weighted by luminance * sin(theta), the solid angle a row covers shrinks towards the poles
+	environmentCDF.assign((height + 1) + height * (width + 1), 0.f);
+	float* marginal = environmentCDF.data();
+	for (int y = 0; y < height; y++) {
+		float sinTheta = sin(glm::pi<float>() * (y + 0.5f) / height);
+		float* conditional = environmentCDF.data() + (height + 1) + y * (width + 1);
+		for (int x = 0; x < width; x++) {
+			float luminance = glm::dot(glm::vec3(environmentTexels[y * width + x]), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+			conditional[x + 1] = conditional[x] + std::max(luminance, 0.f) * sinTheta;
+		}
+
+		float rowWeight = conditional[width];
+		for (int x = 1; x <= width; x++) {
+			//a black row is never picked by the marginal, but keep its cdf valid anyway
+			conditional[x] = rowWeight > 0.f ? conditional[x] / rowWeight : (float) x / width;
+		}
+		conditional[width] = 1.f;
+		marginal[y + 1] = marginal[y] + rowWeight;
+	}
+
+	float totalWeight = marginal[height];
+	for (int y = 1; y <= height; y++) {
+		marginal[y] = totalWeight > 0.f ? marginal[y] / totalWeight : (float) y / height;
+	}
+	marginal[height] = 1.f;
+
+	auto end = std::chrono::system_clock::now();
+	cout << "Environment Map: " << width << "x" << height << ", cdf built in " << std::chrono::duration<float, std::milli>(end - start).count() << "ms\n";
+	return true;
+}
+
+//same growth scheme as the light buffers. without a map only the header goes up and the analytic sky stays in use
+void VulkanEngine::upload_environment_map() {
+	bool firstAllocation = environmentCapacity == 0;
+	if (environmentTexels.size() > environmentCapacity || environmentCDF.size() > environmentCDFCapacity || firstAllocation) {
+		if (!firstAllocation) {
+			vkDeviceWaitIdle(device);
+			vmaDestroyBuffer(allocator, environmentMapBuffer.buffer, environmentMapBuffer.allocation);
+			vmaDestroyBuffer(allocator, environmentCDFBuffer.buffer, environmentCDFBuffer.allocation);
+		}
+
+		environmentCapacity = std::max<size_t>(std::max<size_t>(environmentTexels.size(), environmentCapacity * 2), 16);
+		environmentCDFCapacity = std::max<size_t>(std::max<size_t>(environmentCDF.size(), environmentCDFCapacity * 2), 16);
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		environmentMapBuffer = create_buffer(sizeof(EnvironmentMapHeader) + sizeof(glm::vec4) * environmentCapacity, usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		environmentCDFBuffer = create_buffer(sizeof(float) * environmentCDFCapacity, usage, VMA_MEMORY_USAGE_GPU_ONLY);
+
+		if (firstAllocation) {
+			deletionQueue.push_function([=]() {
+				vmaDestroyBuffer(allocator, environmentMapBuffer.buffer, environmentMapBuffer.allocation);
+				vmaDestroyBuffer(allocator, environmentCDFBuffer.buffer, environmentCDFBuffer.allocation);
+			});
+		} else {
+			write_environment_descriptors();
+		}
+	}
+
+	//the header is exactly one vec4, so header and texels go up in one copy
+	std::vector<glm::vec4> mapData(1 + environmentTexels.size());
+	memcpy(mapData.data(), &environmentMap, sizeof(EnvironmentMapHeader));
+	std::copy(environmentTexels.begin(), environmentTexels.end(), mapData.begin() + 1);
+	update_buffer(sizeof(glm::vec4) * mapData.size(), environmentMapBuffer, mapData.data());
+	if (!environmentCDF.empty()) update_buffer(sizeof(float) * environmentCDF.size(), environmentCDFBuffer, environmentCDF.data());
+}
+
+void VulkanEngine::write_environment_descriptors() {
+	VkDescriptorBufferInfo environmentMapInfo;
+	environmentMapInfo.buffer = environmentMapBuffer.buffer;
+	environmentMapInfo.offset = 0;
+	environmentMapInfo.range = sizeof(EnvironmentMapHeader) + sizeof(glm::vec4) * environmentCapacity;
+
+	VkDescriptorBufferInfo environmentCDFInfo;
+	environmentCDFInfo.buffer = environmentCDFBuffer.buffer;
+	environmentCDFInfo.offset = 0;
+	environmentCDFInfo.range = sizeof(float) * environmentCDFCapacity;
+
+	VkWriteDescriptorSet environmentWrites[] = {
+		vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &environmentMapInfo, 29),
+		vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &environmentCDFInfo, 30)
+	};
+	vkUpdateDescriptorSets(device, std::size(environmentWrites), environmentWrites, 0, nullptr);
+}
+
+//grows the view buffer and layered image to hold count cameras at extent, rewriting their descriptors if they move
+void VulkanEngine::allocate_views(uint count, VkExtent2D extent) {
+	bool firstAllocation = viewCapacity == 0;
+	if (!firstAllocation) {
+		if (count <= viewCapacity && extent.width == viewImageExtent.width && extent.height == viewImageExtent.height) return;
+		vkDeviceWaitIdle(device);
+		vmaDestroyBuffer(allocator, viewBuffer.buffer, viewBuffer.allocation);
+		vkDestroyImageView(device, viewImageView, nullptr);
+		vmaDestroyImage(allocator, viewImage.image, viewImage.allocation);
+	}
+
+	viewCapacity = std::max<uint>(std::max(count, viewCapacity), 1);
+	viewImageExtent = extent;
+	viewBuffer = create_buffer(sizeof(CameraInfo) * viewCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+	VkImageCreateInfo imageInfo = vkinit::imageCreateInfo(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, {extent.width, extent.height, 1});
+	imageInfo.arrayLayers = viewCapacity;
+	VmaAllocationCreateInfo imageAllocInfo{};
+	imageAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	VK_CHECK(vmaCreateImage(allocator, &imageInfo, &imageAllocInfo, &viewImage.image, &viewImage.allocation, nullptr));
+
+	VkImageViewCreateInfo viewInfo = vkinit::imageViewCreateInfo(VK_FORMAT_R8G8B8A8_UNORM, viewImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	viewInfo.subresourceRange.layerCount = viewCapacity;
+	VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &viewImageView));
+
+	immediate_submit([=](VkCommandBuffer cmd) {
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.image = viewImage.image;
+		barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, viewCapacity};
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	});
+
+	if (firstAllocation) {
+		deletionQueue.push_function([=]() {
+			vmaDestroyBuffer(allocator, viewBuffer.buffer, viewBuffer.allocation);
+			vkDestroyImageView(device, viewImageView, nullptr);
+			vmaDestroyImage(allocator, viewImage.image, viewImage.allocation);
+		});
+	} else {
+		write_view_descriptors();
+	}
+}
+
+void VulkanEngine::write_view_descriptors() {
+	VkDescriptorBufferInfo viewBufferInfo;
+	viewBufferInfo.buffer = viewBuffer.buffer;
+	viewBufferInfo.offset = 0;
+	viewBufferInfo.range = sizeof(CameraInfo) * viewCapacity;
+
+	VkDescriptorImageInfo viewImageInfo;
+	viewImageInfo.sampler = VK_NULL_HANDLE;
+	viewImageInfo.imageView = viewImageView;
+	viewImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkWriteDescriptorSet viewWrites[] = {
+		vkinit::writeDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, computeSet, &viewBufferInfo, 20),
+		vkinit::writeDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, computeSet, &viewImageInfo, 21)
+	};
+	vkUpdateDescriptorSets(device, std::size(viewWrites), viewWrites, 0, nullptr);
+}
+
+//cameras orbiting the world y axis, starting from the current one
+void VulkanEngine::turntable_views(uint count) {
+	views.clear();
+	for (uint i = 0; i < count; i++) {
+		glm::mat3 orbit = glm::mat3(glm::rotate(glm::radians(360.f * i / count), glm::vec3(0.f, 1.f, 0.f)));
+		CameraInfo view = cameraInfo;
+		view.pos = orbit * cameraInfo.pos;
+		view.cameraRotation = glm::mat4(orbit * glm::mat3(cameraInfo.cameraRotation));
+		view.aspectRatio = viewExtent.width / (float) viewExtent.height;
+		views.push_back(view);
+	}
+}
+
+//one submission and one dispatch for every camera in views, each layer gets sampleLimit samples
+void VulkanEngine::render_views() {
+	if (views.empty()) return;
+	allocate_views(views.size(), viewExtent);
+	update_buffer(sizeof(CameraInfo) * views.size(), viewBuffer, views.data());
+
+	bool useRayQuery = rayQuery && rayQueryModule != VK_NULL_HANDLE;
+	VkPipeline pipeline = megakernel_variant(useRayQuery, true);
+	glm::uvec2 groupSize = megakernelGroupShapes[groupShape];
+
+	PushConstants batch = constants;
+	batch.environment = environment;
+	batch.rayTraceParams = rayTracerParams;
+	batch.rayTraceParams.sphereCount = orderedSpheres.size();
+	batch.rayTraceParams.objectCount = objects.size();
+	batch.rayTraceParams.lightCount = lights.size();
+	batch.rayTraceParams.persistentThreads = false;
+	batch.tileOffset = glm::uvec2(0);
+	batch.primaryHitMode = PRIMARY_HITS_OFF;
+
+	//the dispatch is timed on the gpu, the frame's timings are replaced until the next frame resolves its own
+	auto start = std::chrono::system_clock::now();
+	immediate_submit([&](VkCommandBuffer cmd) {
+		profiler.reset(cmd);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeLayout, 0, 1, &computeSet, 0, nullptr);
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdPushConstants(cmd, computePipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &batch);
+		int scope = profiler.begin(cmd, "view batch");
+		vkCmdDispatch(cmd, (viewExtent.width + groupSize.x - 1) / groupSize.x, (viewExtent.height + groupSize.y - 1) / groupSize.y, views.size());
+		profiler.end(cmd, scope);
+	});
+	auto end = std::chrono::system_clock::now();
+	profiler.resolve(device);
+
+	//without timestamps the submission to fence time is the best there is
+	viewBatchHostTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
+	viewBatchTime = profiler.supported ? profiler.get("view batch") : viewBatchHostTime;
+	viewShown = std::min<int>(viewShown, views.size() - 1);
+	cout << "Rendered " << views.size() << " views at " << viewExtent.width << "x" << viewExtent.height << " in " << viewBatchTime << "ms ("
+		<< views.size() * 1000.f / viewBatchTime << " views/s" << (profiler.supported ? ", gpu" : ", host") << ")\n";
+}
 
-	RayMaterial object;
-	object.albedoIndex = -1;
-	object.metalnessIndex = -1;
-	//object.ior = 1.5f;
+//the same views the way a per-frame loop would render them, one submission and one dispatch per camera, then the
+//batch, so both can be read side by side. dispatch base picks the view, the batch pipeline is built to allow it
+void VulkanEngine::compare_view_loop() {
+	if (views.empty()) return;
+	allocate_views(views.size(), viewExtent);
+	update_buffer(sizeof(CameraInfo) * views.size(), viewBuffer, views.data());
+
+	bool useRayQuery = rayQuery && rayQueryModule != VK_NULL_HANDLE;
+	VkPipeline pipeline = megakernel_variant(useRayQuery, true);
+	glm::uvec2 groupSize = megakernelGroupShapes[groupShape];
+
+	PushConstants single = constants;
+	single.environment = environment;
+	single.rayTraceParams = rayTracerParams;
+	single.rayTraceParams.sphereCount = orderedSpheres.size();
+	single.rayTraceParams.objectCount = objects.size();
+	single.rayTraceParams.persistentThreads = false;
+	single.tileOffset = glm::uvec2(0);
+	single.primaryHitMode = PRIMARY_HITS_OFF;
+
+	viewLoopTime = 0.f;
+	viewLoopHostTime = 0.f;
+	for (uint view = 0; view < views.size(); view++) {
+		auto start = std::chrono::system_clock::now();
+		immediate_submit([&](VkCommandBuffer cmd) {
+			profiler.reset(cmd);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeLayout, 0, 1, &computeSet, 0, nullptr);
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+			vkCmdPushConstants(cmd, computePipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &single);
+			int scope = profiler.begin(cmd, "view loop");
+			vkCmdDispatchBase(cmd, 0, 0, view, (viewExtent.width + groupSize.x - 1) / groupSize.x, (viewExtent.height + groupSize.y - 1) / groupSize.y, 1);
+			profiler.end(cmd, scope);
+		});
+		auto end = std::chrono::system_clock::now();
+		profiler.resolve(device);
 
-	rayMaterials.push_back(white);
-	rayMaterials.push_back(red);
-	rayMaterials.push_back(green);
-	rayMaterials.push_back(li);
-	rayMaterials.push_back(mirror);
-	rayMaterials.push_back(dielectric);
-	// rayMaterials.push_back(object);
+		float hostTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
+		viewLoopHostTime += hostTime;
+		viewLoopTime += profiler.supported ? profiler.get("view loop") : hostTime;
+	}
 
-	//ccw
-	ImGuiObject model;
-	model.name = "sponza";
-	model.scale = glm::vec3(1.f);
-	//read_obj("../assets/sponza2/sponza_tri.obj", model, 0);
+	render_views();
+	cout << "View loop vs batch (" << views.size() << " views at " << viewExtent.width << "x" << viewExtent.height << "):\n";
+	cout << "  per-view loop: " << viewLoopTime << "ms gpu, " << viewLoopHostTime << "ms host\n";
+	cout << "  batch:         " << viewBatchTime << "ms gpu, " << viewBatchHostTime << "ms host\n";
+}
 
-	model.name = "cube";
-	model.scale = glm::vec3(0.25f);
-	model.samplerIndex = 1;
-	model.rotation = glm::vec3(0.f, -30.f, 0.f);
-	model.position = glm::vec3(-0.4f, 0.25f, -0.45f);
-	read_obj("../assets/cube.obj", model, 0);
+//binary ppm of one layer of viewImage, the batch's only way out of the gpu
+void VulkanEngine::save_view(uint layer, const char* path) {
+	std::vector<uint8_t> pixels = read_image(viewImage.image, viewImageExtent, layer);
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		cout << "cannot write " << path << endl;
+		return;
+	}
 
-	model.name = "cube2";
-	model.scale = glm::vec3(0.3f, 0.7f, 0.3f);
-	model.samplerIndex = 1;
-	model.rotation = glm::vec3(0.f, 30.f, 0.f);
-	model.position = glm::vec3(0.4f, -0.2f, 0.45f);
-	read_obj("../assets/cube.obj", model, 0);
+	file << "P6\n" << viewImageExtent.width << " " << viewImageExtent.height << "\n255\n";
+	for (size_t i = 0; i < pixels.size(); i += 4) {
+		file.write((const char*) &pixels[i], 3);
+	}
+	cout << "Saved view " << layer << " to " << path << endl;
+}
 
-	model.name = "bunny";
-	model.scale = glm::vec3(0.7f);
-	model.samplerIndex = 1;
-	model.position = glm::vec3(0.f, 0.53f, 0.f);
-	//read_obj("../assets/bunny_full.obj", model, 5);
+//rgba8 copy of one layer of a storage image in the general layout
+std::vector<uint8_t> VulkanEngine::read_image(VkImage image, VkExtent2D extent, uint layer) {
+	size_t size = extent.width * extent.height * 4;
+	AllocatedBuffer readback = create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
 
-	cornell_box();
+	immediate_submit([&](VkCommandBuffer cmd) {
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		VkBufferImageCopy region{};
+		region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, layer, 1};
+		region.imageExtent = {extent.width, extent.height, 1};
+		vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_GENERAL, readback.buffer, 1, &region);
+	});
 
-	copy_buffer(sizeof(RayMaterial) * rayMaterials.size(), materialBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) rayMaterials.data());
-	copy_buffer(sizeof(TrianglePoint) * triPoints.size(), triPointBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) triPoints.data());
-	copy_buffer(sizeof(Triangle) * triangles.size(), triangleBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) triangles.data());
-	copy_buffer(sizeof(RenderObject) * objects.size(), objectBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) objects.data());
-	copy_buffer(sizeof(BVHNode) * bvhNodes.size(), bvhBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, (void*) bvhNodes.data());
+	std::vector<uint8_t> pixels(size);
+	void* data;
+	vmaMapMemory(allocator, readback.allocation, &data);
+	memcpy(pixels.data(), data, size);
+	vmaUnmapMemory(allocator, readback.allocation);
+	vmaDestroyBuffer(allocator, readback.buffer, readback.allocation);
+	return pixels;
 }
 
 bool VulkanEngine::load_shader_module(const char* filePath, VkShaderModule* outShaderModule) {
@@ -1183,9 +2720,12 @@ void VulkanEngine::build_bvh(int size, int triIndex, BoundingBox scene) {
 
 	bvhNodes.resize(nodesUsed);
 	bvhNodes.shrink_to_fit();	
+	reorder_bvh_breadth_first(offset);
+	bvhMeshes.push_back({(uint) offset, (uint) triIndex, (uint) size});
 
 	auto end = std::chrono::system_clock::now();    
 	auto time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+	bvhBuildTime += std::chrono::duration<float, std::milli>(end - start).count();
 	cout << "BVH Build Time: " << time.count() << "ms\n";
 	cout << "Node Count: " << nodesUsed - offset << endl;
 	cout << "Max Depth: " << stats.maxDepth << endl;
@@ -1193,6 +2733,73 @@ void VulkanEngine::build_bvh(int size, int triIndex, BoundingBox scene) {
 	cout << "Max Tris: " << stats.maxTri << endl;
 }
 
+//children stay in adjacent pairs, but every level of the mesh comes before the next one
+void VulkanEngine::reorder_bvh_breadth_first(uint root) {
+	std::vector<BVHNode> ordered;
+	ordered.reserve(bvhNodes.size() - root);
+	ordered.push_back(bvhNodes[root]);
+	for (size_t i = 0; i < ordered.size(); i++) {
+		if (ordered[i].triCount != 0) continue;
+		uint children = ordered[i].index;
+		ordered[i].index = root + ordered.size();
+		ordered.push_back(bvhNodes[children]);
+		ordered.push_back(bvhNodes[children + 1]);
+	}
+	std::copy(ordered.begin(), ordered.end(), bvhNodes.begin() + root);
+}
+
+//nodes in the first levels of a mesh, always the first nodes after its root because of the breadth first order
+uint VulkanEngine::bvh_level_nodes(uint root, uint levels) {
+	uint count = 0;
+	std::vector<std::pair<uint, uint>> queue = {{root, 0}};
+	for (size_t i = 0; i < queue.size(); i++) {
+		auto [index, depth] = queue[i];
+		if (depth >= levels) continue;
+		count++;
+		if (bvhNodes[index].triCount == 0) {
+			queue.push_back({bvhNodes[index].index, depth + 1});
+			queue.push_back({bvhNodes[index].index + 1, depth + 1});
+		}
+	}
+	return count;
+}
+
+//as many levels of every mesh as fit in half the shared memory, the rest is left for occupancy
+void VulkanEngine::layout_bvh_cache() {
+	uint budget = gpuProperties.limits.maxComputeSharedMemorySize / 2 / sizeof(BVHNode);
+	uint levels = MAX_BVH_CACHE_LEVELS;
+	for (; levels > 0; levels--) {
+		uint total = 0;
+		for (BVHMesh& mesh : bvhMeshes) {
+			total += bvh_level_nodes(mesh.rootIndex, levels);
+		}
+		if (total <= budget) break;
+	}
+
+	uint offset = 0;
+	for (BVHMesh& mesh : bvhMeshes) {
+		mesh.cacheOffset = offset;
+		mesh.cacheCount = bvh_level_nodes(mesh.rootIndex, levels);
+		offset += mesh.cacheCount;
+	}
+
+	bvhCacheLevels = levels;
+	bvhCacheNodes = std::max(offset, 1u);
+	cout << "BVH Cache: " << levels << " levels, " << offset << " nodes\n";
+}
+
+//per object copies of its mesh's triangle offset (ray query hits are relative to it) and shared memory cache range
+void VulkanEngine::update_object_meshes() {
+	for (RenderObject& renderObject : objects) {
+		for (BVHMesh& mesh : bvhMeshes) {
+			if (mesh.rootIndex != renderObject.bvhIndex) continue;
+			renderObject.triOffset = mesh.triOffset;
+			renderObject.cacheOffset = mesh.cacheOffset;
+			renderObject.cacheCount = bvhCache ? mesh.cacheCount : 0;
+		}
+	}
+}
+
 void VulkanEngine::update_bvh_bounds(uint index) {
 	BVHNode& node = bvhNodes[index];
 	BoundingBox box;
@@ -1375,11 +2982,23 @@ float VulkanEngine::scene_interior_cost(BoundingBox node, BoundingBox scene) {
 void VulkanEngine::init_image() {
 	textures.resize(MAX_TEXTURES);
 
-	vkutil::create_empty_image(*this, computeImage.image, _windowExtent);
+	vkutil::create_empty_image(*this, computeImage.image, _windowExtent, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 
 	VkImageViewCreateInfo viewInfo = vkinit::imageViewCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, computeImage.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
 	VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &computeImage.imageView));
 
+	vkutil::create_empty_image(*this, primaryHitImage.image, _windowExtent, VK_FORMAT_R32G32B32A32_UINT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+	VkImageViewCreateInfo primaryHitViewInfo = vkinit::imageViewCreateInfo(VK_FORMAT_R32G32B32A32_UINT, primaryHitImage.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	VK_CHECK(vkCreateImageView(device, &primaryHitViewInfo, nullptr, &primaryHitImage.imageView));
+
+	vkutil::create_empty_image(*this, accumulationImage.image, _windowExtent, VK_FORMAT_R32G32B32A32_SFLOAT);
+	VkImageViewCreateInfo accumulationViewInfo = vkinit::imageViewCreateInfo(VK_FORMAT_R32G32B32A32_SFLOAT, accumulationImage.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	VK_CHECK(vkCreateImageView(device, &accumulationViewInfo, nullptr, &accumulationImage.imageView));
+
+	vkutil::create_empty_image(*this, luminanceM2Image.image, _windowExtent, VK_FORMAT_R32_SFLOAT);
+	VkImageViewCreateInfo luminanceM2ViewInfo = vkinit::imageViewCreateInfo(VK_FORMAT_R32_SFLOAT, luminanceM2Image.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	VK_CHECK(vkCreateImageView(device, &luminanceM2ViewInfo, nullptr, &luminanceM2Image.imageView));
+
 	//im stupid and bad at memory
 	AllocatedImage textureImages[MAX_TEXTURES];
 	vkutil::create_empty_images(*this, textureImages, _windowExtent, MAX_TEXTURES);
@@ -1391,6 +3010,9 @@ void VulkanEngine::init_image() {
 
 	deletionQueue.push_function([=]() {
 		vkDestroyImageView(device, computeImage.imageView, nullptr);
+		vkDestroyImageView(device, primaryHitImage.imageView, nullptr);
+		vkDestroyImageView(device, accumulationImage.imageView, nullptr);
+		vkDestroyImageView(device, luminanceM2Image.imageView, nullptr);
 		for (int i = 0; i < MAX_TEXTURES; i++) {
 			vmaDestroyImage(allocator, textureImages[i].image, textureImages[i].allocation);
 			vkDestroyImageView(device, textures[i].imageView, nullptr);
@@ -1444,6 +3066,9 @@ void VulkanEngine::copy_buffer(size_t bufferSize, AllocatedBuffer& buffer, VkBuf
 }
 
 void VulkanEngine::update_buffer(size_t bufferSize, AllocatedBuffer& buffer, void* bufferData) {
+	//every scene edit comes through here, cached camera ray hits may be stale now
+	primaryHitsValid = false;
+
 	VkBufferCreateInfo stagingInfo{};
 	stagingInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	stagingInfo.size = bufferSize;
@@ -1498,23 +3123,170 @@ void VulkanEngine::imgui_draw() {
 		ImGui::Text("drawtime: %.3fms", renderStats.drawTime);
 		ImGui::Text("frametime: %.3fms", renderStats.frameTime);
 		ImGui::Text("fps: %.1f", 1.f / (renderStats.frameTime / 1000.f));
+		ImGui::Text("bvh build: %.3fms", bvhBuildTime);
+		ImGui::Text("bvh cache: %u levels, %u nodes", bvhCacheLevels, bvhCacheNodes);
+		if (rayQuerySupported) ImGui::Text("blas/tlas build: %.3fms", accelBuildTime);
+		if (rayQueryModule != VK_NULL_HANDLE && ImGui::Button("Compare Backends")) run_backend_benchmark(16);
+		if (backendTraceTimes[0] > 0.f) {
+			ImGui::Text("software bvh: build %.3fms, trace %.3fms", bvhBuildTime, backendTraceTimes[0]);
+			ImGui::Text("ray query: build %.3fms, trace %.3fms", accelBuildTime, backendTraceTimes[1]);
+		}
+
+		for (auto& timing : profiler.timings) {
+			ImGui::Text("%s: %.3fms", timing.first.c_str(), timing.second);
+		}
+		if (profiler.droppedScopes > 0) ImGui::TextColored({1.f, 0.f, 0.f, 1.f}, "%u scopes dropped, timings are partial", profiler.droppedScopes);
+
+		if (wavefront) {
+			const char* stageNames[WAVEFRONT_STAGES] = {"generated", "extended", "shaded", "connected", "finalized", "sort keyed", "", "sorted"};
+			for (int i = 0; i < WAVEFRONT_STAGES; i++) {
+				if (i != WAVEFRONT_SORT_SCAN) ImGui::Text("%s: %u", stageNames[i], wavefrontCounters[i]);
+			}
+
+			//closest hit + shadow rays over the time of every wavefront stage, so sorting has to pay for itself.
+			//only the stage scopes count, not whatever else the frame timed
+			const char* stageScopes[] = {"generate", "extend (primary)", "extend (bounces)", "sort", "shade", "connect", "finalize"};
+			float frameTime = 0.f;
+			for (const char* scope : stageScopes) {
+				frameTime += profiler.get(scope);
+			}
+			float rays = wavefrontCounters[WAVEFRONT_EXTEND] + wavefrontCounters[WAVEFRONT_CONNECT];
+			ImGui::Text("Mrays/s: %.1f", frameTime > 0 ? rays / (frameTime * 1000.f) : 0.f);
+		}
 	}
 
 	if (ImGui::CollapsingHeader("Ray Tracer Info")) {
 		ImGui::Checkbox("Progressive Rendering", &rayTracerParams.progressive);
 		ImGui::Checkbox("Automatic Progressive Rendering", &autoProgressive);
+		if (adaptivePipeline != VK_NULL_HANDLE) {
+			ImGui::Checkbox("Adaptive Sampling", &adaptiveSampling);
+			if (adaptiveSampling) {
+				ImGui::DragFloat("Error Threshold", &rayTracerParams.adaptiveThreshold, 0.001f, 0.001f, 1.f, "%.3f");
+				ImGui::Text("active pixels: %.1f%%", 100.f * activePixelFraction);
+			}
+		}
+		if (guidePipeline != VK_NULL_HANDLE) {
+			ImGui::Checkbox("Path Guiding", &pathGuiding);
+			if (pathGuiding) {
+				ImGui::Checkbox("Guide Learning", &guideLearning);
+				if (ImGui::DragFloat("Guide Cell Size", &guideCellSize, 0.01f, 0.01f, 10.f)) guideReset = true;
+				ImGui::DragInt("Guide Update Interval", &guideUpdateInterval, 1.f, 1, 64);
+				if (ImGui::Button("Reset Guide")) guideReset = true;
+				ImGui::Text("training iteration %u, %u / %u cells", guideIteration, guideCellsUsed, GUIDE_CELLS);
+				ImGui::Text("guide memory: %.1f MB", GUIDE_BUFFER_SIZE / (1024.f * 1024.f));
+			}
+		}
+		if (restirPipelines[0] != VK_NULL_HANDLE) {
+			ImGui::Checkbox("ReSTIR Direct Lighting", &restir);
+			if (restir) {
+				ImGui::Checkbox("Temporal Reuse", &restirTemporal);
+				ImGui::Checkbox("Spatial Reuse", &restirSpatial);
+			}
+		}
+		if (restirGIPipelines[0] != VK_NULL_HANDLE) {
+			ImGui::Checkbox("ReSTIR GI", &restirGI);
+			if (restirGI) {
+				ImGui::Checkbox("GI Temporal Reuse", &restirGITemporal);
+				ImGui::Checkbox("GI Spatial Reuse", &restirGISpatial);
+			}
+		}
 		ImGui::Checkbox("Single Rendering", &rayTracerParams.singleRender);
 
 		float sampleProgress = (float) totalSamples / rayTracerParams.sampleLimit;
+		if (rayTracerParams.singleRender && tileCount > 0 && nextTile > 0 && totalSamples < rayTracerParams.sampleLimit) {
+			sampleProgress = (float) nextTile / tileCount;
+		}
 		glm::vec4 c = glm::mix(glm::vec4(1.f, 0.f, 0.f, 1.f), glm::vec4(0.f, 1.f, 0.f, 1.f), sampleProgress);
 
 		ImGui::TextColored({c.r, c.g, c.b, c.a}, "Single Render Progress: %.1f%%", 100 * sampleProgress);
-		ImGui::SliderInt("Debug Mode", &rayTracerParams.debug, -1, 2, "%d");
+		if (rayTracerParams.singleRender) {
+			ImGui::Checkbox("Tiled Single Render", &tiledSingleRender);
+			if (tiledSingleRender) {
+				//tiles stay a multiple of the workgroup size, wavefront tiles are pool samples instead
+				if (!wavefront && ImGui::DragInt("Tile Size", &tileSize, 8.f, 8, 1024)) tileSize = std::max(8, tileSize / 8 * 8);
+				ImGui::DragFloat("Tile Budget (ms)", &tileBudget, 0.5f, 1.f, 500.f);
+				ImGui::Text("tiles: %u / %u (%u per frame)", nextTile, tileCount, tilesPerFrame);
+			}
+		}
+		ImGui::SliderInt("Debug Mode", &rayTracerParams.debug, -1, 4, "%d");
 		ImGui::DragInt("Rays Per Pixel", (int*) &rayTracerParams.raysPerPixel, 1.f, 0, 1000);
 		ImGui::DragInt("Bounce Limit", (int*) &rayTracerParams.bounceLimit, 1.f, 0, 100);
+		bounceLimitEditing = ImGui::IsItemActive();
 		ImGui::DragInt("Triangle Test Threshold", (int*) &rayTracerParams.triangleCap, 1.f, 0);
 		ImGui::DragInt("Box Test Threshold", (int*) &rayTracerParams.boxCap, 1.f, 0);
 		ImGui::DragInt("Sample Limit", (int*) &rayTracerParams.sampleLimit, 1.f, 0);
+
+		if (subgroupSupported) {
+			ImGui::Checkbox("Persistent Threads", &rayTracerParams.persistentThreads);
+			ImGui::DragInt("Persistent Workgroups", (int*) &persistentWorkgroups, 1.f, 1, gpuProperties.limits.maxComputeWorkGroupCount[0]);
+			ImGui::Checkbox("Wavefront", &wavefront);
+			if (wavefront) ImGui::Checkbox("Sort Paths", &sortPaths);
+		}
+
+		//megakernel only, the wavefront kernels keep the software bvh
+		if (rayQueryModule != VK_NULL_HANDLE) ImGui::Checkbox("Ray Query", &rayQuery);
+
+		ImGui::Text("megakernel variants: %zu", megakernelVariants.size());
+
+		const char* samplerNames[SAMPLER_TYPES] = {"PCG", "Sobol", "Blue Noise"};
+		ImGui::Combo("Sampler", (int*) &rayTracerParams.samplerType, samplerNames, SAMPLER_TYPES);
+		if (ImGui::Button("Benchmark Samplers")) run_sampler_benchmark();
+		if (samplerBenchmarkDone) {
+			for (int i = 0; i < SAMPLER_BENCHMARK_COUNTS; i++) {
+				ImGui::Text("%dspp: rmse %.4f pcg, %.4f sobol, %.4f blue noise", 1 << (2 * i), samplerBenchmarkResults[i][SAMPLER_PCG],
+					samplerBenchmarkResults[i][SAMPLER_SOBOL], samplerBenchmarkResults[i][SAMPLER_BLUE_NOISE]);
+			}
+		}
+
+		const char* mappingNames[PIXEL_MAPPINGS] = {"Row Major", "Morton", "Morton + Swizzle"};
+		if (ImGui::Combo("Pixel Mapping", (int*) &pixelMapping, mappingNames, PIXEL_MAPPINGS)) nextTile = 0;
+		const char* shapeNames[MEGAKERNEL_GROUP_SHAPES] = {"8x8", "16x4", "32x2", "4x16"};
+		if (ImGui::Combo("Workgroup Shape", &groupShape, shapeNames, MEGAKERNEL_GROUP_SHAPES)) nextTile = 0;
+
+		if (mappingBenchmark.running) {
+			ImGui::Text("benchmarking %u / %u", mappingBenchmark.config + 1, PIXEL_MAPPINGS * MEGAKERNEL_GROUP_SHAPES);
+		} else {
+			ImGui::Checkbox("Benchmark Primary Rays Only", &mappingBenchmark.primaryOnly);
+			if (ImGui::Button("Benchmark Pixel Mappings")) start_mapping_benchmark();
+		}
+		if (mappingBenchmark.best >= 0) {
+			for (int i = 0; i < PIXEL_MAPPINGS * MEGAKERNEL_GROUP_SHAPES; i++) {
+				ImGui::Text("%s%s %s: %.3fms", i == mappingBenchmark.best ? "* " : "", mappingNames[i / MEGAKERNEL_GROUP_SHAPES], shapeNames[i % MEGAKERNEL_GROUP_SHAPES], mappingBenchmark.results[i]);
+			}
+		}
+
+		ImGui::Checkbox("Primary Hit Cache", &primaryHitCache);
+		if (visibilityPipeline != VK_NULL_HANDLE) ImGui::Checkbox("Rasterize Primary Hits", &rasterPrimaryHits);
+
+		if (ImGui::Checkbox("BVH Shared Memory Cache", &bvhCache)) {
+			update_object_meshes();
+			update_buffer(sizeof(RenderObject) * objects.size(), objectBuffer, objects.data());
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Multi-View")) {
+		ImGui::DragInt("Views", &turntableViews, 1.f, 1, 1024);
+		int extent[2] = {(int) viewExtent.width, (int) viewExtent.height};
+		if (ImGui::DragInt2("View Resolution", extent, 1.f, 8, 4096)) {
+			viewExtent = {(uint) std::max(extent[0], 8), (uint) std::max(extent[1], 8)};
+		}
+		if (ImGui::Button("Render Turntable")) {
+			turntable_views(turntableViews);
+			render_views();
+		}
+		if (ImGui::Button("Compare Per-View Loop")) {
+			turntable_views(turntableViews);
+			compare_view_loop();
+		}
+		if (viewBatchTime > 0.f) {
+			ImGui::Text("last batch: %.2fms (%.1f views/s)", viewBatchTime, views.size() * 1000.f / viewBatchTime);
+			if (viewLoopTime > 0.f) ImGui::Text("per-view loop: %.2fms (%.1f views/s)", viewLoopTime, views.size() * 1000.f / viewLoopTime);
+			ImGui::SliderInt("View", &viewShown, 0, views.size() - 1);
+			if (ImGui::Button("Save View")) {
+				std::string path = "view_" + std::to_string(viewShown) + ".ppm";
+				save_view(viewShown, path.c_str());
+			}
+		}
 	}
 
 	if (ImGui::CollapsingHeader("Camera Info")) {
@@ -1531,6 +3303,21 @@ void VulkanEngine::imgui_draw() {
 		ImGui::DragFloat3("Sun Direction", (float*) &environment.lightDir, 0.01f, 0.f, 1.f);
 		ImGui::DragFloat("Sun Focus", &environment.horizonColor.w, 0.1f, 0.f, 100.f);
 		ImGui::DragFloat("Sun Intensity", &environment.zenithColor.w, 0.1f, 0.f, 100.f);
+
+		ImGui::InputText("Environment Map File", environmentMapFile, sizeof(environmentMapFile));
+		if (ImGui::Button("Load Environment Map") && load_environment_map(environmentMapFile)) {
+			upload_environment_map();
+		}
+		if (environmentMap.width > 0) {
+			ImGui::Text("%ux%u", environmentMap.width, environmentMap.height);
+			bool enabled = environmentMap.enabled;
+			bool changed = ImGui::Checkbox("Environment Map", &enabled);
+			changed |= ImGui::DragFloat("Environment Map Intensity", &environmentMap.intensity, 0.01f, 0.f, 100.f);
+			if (changed) {
+				environmentMap.enabled = enabled;
+				update_buffer(sizeof(EnvironmentMapHeader), environmentMapBuffer, &environmentMap);
+			}
+		}
 	}
 
 	if (ImGui::CollapsingHeader("Materials")) {
@@ -1543,6 +3330,17 @@ void VulkanEngine::imgui_draw() {
 
 		if (ImGui::Button("Update Buffer")) {
 			update_buffer(sizeof(RayMaterial) * rayMaterials.size(), materialBuffer, rayMaterials.data());
+			upload_lights();
+		}
+
+		ImGui::Text("%zu lights (%zu tree nodes)", lights.size(), lightNodes.size());
+		ImGui::Checkbox("Light Tree", &rayTracerParams.lightTree);
+		ImGui::DragFloat("Light Benchmark Budget (ms)", &lightBenchmarkBudget, 10.f, 10.f, 10000.f);
+		if (ImGui::Button("Benchmark Light Scaling")) run_light_benchmark();
+		if (lightBenchmarkDone) {
+			for (int i = 0; i < LIGHT_BENCHMARK_SCALES; i++) {
+				ImGui::Text("%d lights: rmse %.4f power, %.4f tree", (int) pow(10, i), lightBenchmarkResults[i][0], lightBenchmarkResults[i][1]);
+			}
 		}
 		ImGui::Indent(4.f);
 
@@ -1564,17 +3362,28 @@ void VulkanEngine::imgui_draw() {
 		ImGui::Indent(16.f);
 		ImGui::Unindent(4.f);
 
-		if (ImGui::Button("Add Sphere") && spheres.size() < MAX_SPHERES) {
+		if (ImGui::Button("Add Sphere")) {
 			spheres.push_back({glm::vec3(0.f), 1.f, 0});
 		}
 
+		//stress test for the sphere bvh, small spheres scattered through the box
+		if (ImGui::Button("Add 1000 Spheres")) {
+			for (int i = 0; i < 1000; i++) {
+				glm::vec3 position = glm::vec3(rand(), rand(), rand()) / (float) RAND_MAX * 1.8f - 0.9f;
+				spheres.push_back({position, 0.02f, (uint) (rand() % 3)});
+			}
+		}
+
 		if (ImGui::Button("Update Buffer")) {
-			update_buffer(sizeof(Sphere) * MAX_SPHERES, sphereBuffer, spheres.data());
+			upload_spheres();
+			upload_lights();
 		}
 
+		ImGui::Text("%zu spheres, %zu bvh nodes", orderedSpheres.size(), sphereNodes.size());
 		ImGui::Indent(4.f);
 
-		for (int i = 0; i < spheres.size(); i++) {
+		//listing every sphere of a stress scene would stall the ui
+		for (int i = 0; i < std::min<int>(spheres.size(), 64); i++) {
 			if (ImGui::CollapsingHeader(("Sphere " + to_string(i)).c_str())) {
 				ImGui::Indent(16.f);
 				ImGui::DragFloat3("Position", (float*) &spheres[i].position, 0.1f);
@@ -1601,6 +3410,8 @@ void VulkanEngine::imgui_draw() {
 					glm::scale(object.scale);
 			}
 			update_buffer(sizeof(RenderObject) * objects.size(), objectBuffer, objects.data());
+			if (rayQuerySupported) build_tlas();
+			upload_lights();
 		}
 		ImGui::Indent(4.f);
 
@@ -1624,8 +3435,10 @@ void VulkanEngine::run_compute() {
 	VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
 	VkCommandBufferBeginInfo computeCmdInfo = vkinit::commandBufferBeginInfo();
 	VK_CHECK(vkBeginCommandBuffer(computeCmdBuffer, &computeCmdInfo));
+	//the pool can only grow here, after the previous frame's fence and before this frame's first timestamp
+	if (wavefront && subgroupSupported) profiler.reserve(device, wavefront_scopes());
+	profiler.reset(computeCmdBuffer);
 
-	vkCmdBindPipeline(computeCmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
 	vkCmdBindDescriptorSets(computeCmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeLayout, 0, 1, &computeSet, 0, nullptr);
 
 	cameraInfo.aspectRatio = _windowExtent.width / (float) _windowExtent.height;
@@ -1652,17 +3465,159 @@ void VulkanEngine::run_compute() {
 	);
 	cameraInfo.cameraRotation = rotY * rotX * rotZ;
 
-	rayTracerParams.sphereCount = spheres.size();
+	rayTracerParams.sphereCount = orderedSpheres.size();
 	rayTracerParams.objectCount = objects.size();
+	rayTracerParams.lightCount = lights.size();
 
 	constants.camInfo = cameraInfo;
 	constants.environment = environment;
+	//a long single render would freeze the ui and can trip the gpu timeout, so it is traced a few tiles per frame.
+	//the wavefront path's tiles are one sample of one pool each
+	bool tiled = rayTracerParams.singleRender && tiledSingleRender;
+	tilesDispatched = 0;
+
 	constants.rayTraceParams = rayTracerParams;
+	if (tiled) constants.rayTraceParams.persistentThreads = false;
 	constants.frameCount = _frameNumber;
+	constants.tileOffset = glm::uvec2(0);
+
+	//the debug views count every traversal, and tiles only cover part of the screen so they can read but not fill
+	CameraInfo& cached = primaryHitCamera;
+	if (cameraInfo.pos != cached.pos || cameraInfo.cameraRotation != cached.cameraRotation || cameraInfo.fov != cached.fov || cameraInfo.aspectRatio != cached.aspectRatio || cameraInfo.nearPlane != cached.nearPlane) {
+		primaryHitsValid = false;
+	}
+	bool megakernelPrimary = rayTracerParams.debug < 0 && !(wavefront && subgroupSupported);
+	bool cachePrimaryHits = primaryHitCache && megakernelPrimary;
+	bool rasterize = rasterPrimaryHits && megakernelPrimary && !tiled && visibilityPipeline != VK_NULL_HANDLE;
+	constants.primaryHitMode = PRIMARY_HITS_OFF;
+	if (cachePrimaryHits && primaryHitsValid) {
+		constants.primaryHitMode = PRIMARY_HITS_READ;
+	} else if (rasterize) {
+		//recorded before the compute push constants, binding the graphics layout may disturb them
+		rasterize_primary_hits(computeCmdBuffer);
+		constants.primaryHitMode = PRIMARY_HITS_RASTER;
+		primaryHitsValid = cachePrimaryHits;
+		primaryHitCamera = cameraInfo;
+	} else if (cachePrimaryHits && !tiled) {
+		constants.primaryHitMode = PRIMARY_HITS_FILL;
+		primaryHitsValid = true;
+		primaryHitCamera = cameraInfo;
+	}
+
+	//converged pixels drop out of the accumulation. the first frame has no statistics yet, and the frames that fill
+	//the primary hit image have to cover every pixel
+	bool primaryHitsStored = constants.primaryHitMode == PRIMARY_HITS_FILL || constants.primaryHitMode == PRIMARY_HITS_RASTER;
+	//restir gi stores every pixel after the megakernel, so it needs all of them traced and takes precedence over adaptive sampling
+	bool indirectResampling = restirGI && megakernelPrimary && !tiled && restirGIPipelines[0] != VK_NULL_HANDLE;
+	adaptiveDispatched = adaptiveSampling && rayTracerParams.progressive && _frameNumber > 0 && megakernelPrimary && !tiled && !primaryHitsStored && !indirectResampling && adaptivePipeline != VK_NULL_HANDLE;
+	constants.adaptivePixels = adaptiveDispatched;
 
 	vkCmdPushConstants(computeCmdBuffer, computePipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &constants);
 
-	vkCmdDispatch(computeCmdBuffer, ceil(_windowExtent.width / 8.f), ceil(_windowExtent.height / 8.f), 1);
+	//both traversal backends share everything but the pipeline, timings stay separate for comparison
+	bool useRayQuery = rayQuery && rayQueryModule != VK_NULL_HANDLE;
+	bool persistent = rayTracerParams.persistentThreads && !tiled && (useRayQuery ? rayQueryPersistentModule : persistentModule) != VK_NULL_HANDLE;
+	VkPipeline megakernel = wavefront && subgroupSupported ? VK_NULL_HANDLE : megakernel_variant(useRayQuery, false, persistent);
+	const char* megakernelScope = useRayQuery ? "megakernel (ray query)" : "megakernel";
+	glm::uvec2 groupSize = megakernelGroupShapes[groupShape];
+
+	if (adaptiveDispatched) compact_active_pixels(computeCmdBuffer);
+
+	//the guide header follows the ui, a reset clears every cell
+	GuideHeader header;
+	header.enabled = pathGuiding && guidePipeline != VK_NULL_HANDLE;
+	header.cellSize = guideCellSize;
+	if (guideReset) {
+		vkCmdFillBuffer(computeCmdBuffer, guideBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+		compute_barrier(computeCmdBuffer);
+		guideHeader = GuideHeader{0, 0.f};
+		guideReset = false;
+		guideFrames = 0;
+		guideIteration = 0;
+		guideCellsUsed = 0;
+	}
+	if (header.enabled != guideHeader.enabled || header.cellSize != guideHeader.cellSize) {
+		vkCmdUpdateBuffer(computeCmdBuffer, guideBuffer.buffer, 0, sizeof(uint32_t) * 2, &header);
+		compute_barrier(computeCmdBuffer);
+		guideHeader = header;
+	}
+
+	//tiles only cover part of the screen, so they can't build every pixel's reservoir
+	resample_direct_light(computeCmdBuffer, restir && megakernelPrimary && !tiled && restirPipelines[0] != VK_NULL_HANDLE);
+	write_indirect_header(computeCmdBuffer, indirectResampling);
+
+	if (wavefront && subgroupSupported && tiled) {
+		uint pixelCount = _windowExtent.width * _windowExtent.height;
+		tileCount = (pixelCount + WAVEFRONT_POOL_SIZE - 1) / WAVEFRONT_POOL_SIZE * rayTracerParams.sampleLimit;
+		uint lastTile = std::min(nextTile + tilesPerFrame, tileCount);
+
+		int scope = profiler.begin(computeCmdBuffer, "tiles");
+		run_wavefront(computeCmdBuffer, nextTile, lastTile);
+		profiler.end(computeCmdBuffer, scope);
+
+		tilesDispatched = lastTile - nextTile;
+		nextTile = lastTile;
+	} else if (wavefront && subgroupSupported) {
+		run_wavefront(computeCmdBuffer);
+	} else if (tiled) {
+		vkCmdBindPipeline(computeCmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, megakernel);
+
+		//tiles must be whole workgroups or neighbouring tiles would overlap
+		uint groupMax = std::max(groupSize.x, groupSize.y);
+		uint tile = (tileSize + groupMax - 1) / groupMax * groupMax;
+		uint tilesX = (_windowExtent.width + tile - 1) / tile;
+		uint tilesY = (_windowExtent.height + tile - 1) / tile;
+		tileCount = tilesX * tilesY;
+		uint lastTile = std::min(nextTile + tilesPerFrame, tileCount);
+
+		int scope = profiler.begin(computeCmdBuffer, "tiles");
+		for (uint i = nextTile; i < lastTile; i++) {
+			glm::uvec2 offset = glm::uvec2(i % tilesX, i / tilesX) * tile;
+			vkCmdPushConstants(computeCmdBuffer, computePipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, offsetof(PushConstants, tileOffset), sizeof(glm::uvec2), &offset);
+			vkCmdDispatch(computeCmdBuffer, tile / groupSize.x, tile / groupSize.y, 1);
+		}
+		profiler.end(computeCmdBuffer, scope);
+
+		tilesDispatched = lastTile - nextTile;
+		nextTile = lastTile;
+	} else if (persistent) {
+		vkCmdBindPipeline(computeCmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, megakernel);
+
+		//reset the pixel counter, then launch just enough workgroups to keep the gpu full
+		vkCmdFillBuffer(computeCmdBuffer, workQueueBuffer.buffer, 0, sizeof(uint32_t), 0);
+
+		VkBufferMemoryBarrier queueBarrier{};
+		queueBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		queueBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		queueBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		queueBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		queueBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		queueBarrier.buffer = workQueueBuffer.buffer;
+		queueBarrier.offset = 0;
+		queueBarrier.size = VK_WHOLE_SIZE;
+		vkCmdPipelineBarrier(computeCmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &queueBarrier, 0, nullptr);
+
+		int scope = profiler.begin(computeCmdBuffer, megakernelScope);
+		vkCmdDispatch(computeCmdBuffer, persistentWorkgroups, 1, 1);
+		profiler.end(computeCmdBuffer, scope);
+	} else {
+		vkCmdBindPipeline(computeCmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, megakernel);
+		int scope = profiler.begin(computeCmdBuffer, megakernelScope);
+		if (adaptiveDispatched) {
+			vkCmdDispatchIndirect(computeCmdBuffer, adaptiveBuffer.buffer, 0);
+		} else {
+			vkCmdDispatch(computeCmdBuffer, (_windowExtent.width + groupSize.x - 1) / groupSize.x, (_windowExtent.height + groupSize.y - 1) / groupSize.y, 1);
+		}
+		profiler.end(computeCmdBuffer, scope);
+	}
+
+	if (indirectResampling) resample_indirect_light(computeCmdBuffer);
+
+	//only the megakernel trains, the wavefront kernels just sample what it learned
+	guideUpdated = false;
+	if (header.enabled && guideLearning && !(wavefront && subgroupSupported) && ++guideFrames >= (uint) guideUpdateInterval) {
+		update_guide(computeCmdBuffer);
+	}
 
 	vkEndCommandBuffer(computeCmdBuffer);
 
@@ -1675,6 +3630,580 @@ void VulkanEngine::run_compute() {
 	vkQueueSubmit(computeQueue, 1, &computeSubmit, VK_NULL_HANDLE);
 }
 
+//lists the pixels still above the error threshold for this frame's megakernel, which reads the header as its dispatch size
+void VulkanEngine::compact_active_pixels(VkCommandBuffer cmd) {
+	uint32_t header[4] = {0, 1, 1, 0}; //activeGroups, activeCount
+	vkCmdUpdateBuffer(cmd, adaptiveBuffer.buffer, 0, sizeof(header), header);
+	compute_barrier(cmd);
+
+	uint pixelCount = _windowExtent.width * _windowExtent.height;
+	int scope = profiler.begin(cmd, "adaptive compaction");
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, adaptivePipeline);
+	vkCmdDispatch(cmd, (pixelCount + 63) / 64, 1, 1);
+	profiler.end(cmd, scope);
+	compute_barrier(cmd);
+
+	VkBufferCopy countCopy{};
+	countCopy.srcOffset = sizeof(uint32_t) * 3;
+	countCopy.size = sizeof(uint32_t);
+	vkCmdCopyBuffer(cmd, adaptiveBuffer.buffer, adaptiveStatsBuffer.buffer, 1, &countCopy);
+}
+
+//turns the training sums of every cell into its cdf, one workgroup per cell
+void VulkanEngine::update_guide(VkCommandBuffer cmd) {
+	compute_barrier(cmd);
+	int scope = profiler.begin(cmd, "guide update");
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, guidePipeline);
+	vkCmdDispatch(cmd, GUIDE_CELLS, 1, 1);
+	profiler.end(cmd, scope);
+	compute_barrier(cmd);
+
+	VkBufferCopy countCopy{};
+	countCopy.srcOffset = offsetof(GuideHeader, cellsUsed);
+	countCopy.size = sizeof(uint32_t);
+	vkCmdCopyBuffer(cmd, guideBuffer.buffer, guideStatsBuffer.buffer, 1, &countCopy);
+
+	guideFrames = 0;
+	guideIteration++;
+	guideUpdated = true;
+}
+
+//fills this frame's reservoirs for the megakernel, or tells it there are none. a frame without them breaks the history
+void VulkanEngine::resample_direct_light(VkCommandBuffer cmd, bool enabled) {
+	ReservoirHeader header;
+	header.previousCamera = restirCamera;
+	header.frame = restirFrame;
+	header.history = enabled && restirTemporal && restirHistory;
+	header.enabled = enabled;
+	header.spatial = restirSpatial;
+	vkCmdUpdateBuffer(cmd, reservoirBuffer.buffer, 0, sizeof(ReservoirHeader), &header);
+	compute_barrier(cmd);
+
+	restirHistory = enabled;
+	if (!enabled) return;
+
+	int scope = profiler.begin(cmd, "restir");
+	for (int pass = 0; pass < 2; pass++) {
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, restirPipelines[pass]);
+		vkCmdDispatch(cmd, (_windowExtent.width + 7) / 8, (_windowExtent.height + 7) / 8, 1);
+		compute_barrier(cmd);
+	}
+	profiler.end(cmd, scope);
+
+	restirCamera = cameraInfo;
+	restirFrame++;
+}
+
+//tells the megakernel whether to leave its pixels to resample_indirect_light. a frame without it breaks the history
+void VulkanEngine::write_indirect_header(VkCommandBuffer cmd, bool enabled) {
+	ReservoirHeader header;
+	header.previousCamera = giCamera;
+	header.frame = giFrame;
+	header.history = enabled && restirGITemporal && giHistory;
+	header.enabled = enabled;
+	header.spatial = restirGISpatial;
+	vkCmdUpdateBuffer(cmd, giReservoirBuffer.buffer, 0, sizeof(ReservoirHeader), &header);
+	compute_barrier(cmd);
+	giHistory = enabled;
+}
+
+//reuses the candidates the megakernel left and stores every pixel with its primary hit's indirect light added
+void VulkanEngine::resample_indirect_light(VkCommandBuffer cmd) {
+	compute_barrier(cmd);
+	int scope = profiler.begin(cmd, "restir gi");
+	for (int pass = 0; pass < 2; pass++) {
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, restirGIPipelines[pass]);
+		vkCmdDispatch(cmd, (_windowExtent.width + 7) / 8, (_windowExtent.height + 7) / 8, 1);
+		compute_barrier(cmd);
+	}
+	profiler.end(cmd, scope);
+
+	giCamera = cameraInfo;
+	giFrame++;
+}
+
+//cameraRay sends pixel p through the corner at uv = p / dim of a plane 0.1 in front of the camera. this projection maps that
+//corner onto the fragment center, so every fragment sample is exactly the pixel's camera ray. depth is reversed and infinite
+glm::mat4 VulkanEngine::camera_view_projection() {
+	float planeHeight = cameraInfo.nearPlane * tan(glm::radians(cameraInfo.fov * 0.5f)) * 2.f;
+	float planeWidth = planeHeight * cameraInfo.aspectRatio;
+	float planeDistance = 0.1f;
+	float depthNear = 0.0001f;
+
+	glm::mat4 projection(0.f);
+	projection[0][0] = 2.f * planeDistance / planeWidth;
+	projection[1][1] = 2.f * planeDistance / planeHeight;
+	projection[2][0] = 1.f / _windowExtent.width;
+	projection[2][1] = 1.f / _windowExtent.height;
+	projection[2][3] = 1.f;
+	projection[3][2] = depthNear;
+
+	glm::mat4 view = glm::mat4(glm::transpose(glm::mat3(cameraInfo.cameraRotation))) * glm::translate(-cameraInfo.pos);
+	return projection * view;
+}
+
+void VulkanEngine::rasterize_primary_hits(VkCommandBuffer cmd) {
+	VkClearValue clearValues[2];
+	clearValues[0].color.uint32[0] = glm::floatBitsToUint(99999999.f); //same record as a traced miss
+	clearValues[0].color.uint32[1] = 0;
+	clearValues[0].color.uint32[2] = 0xffffffff;
+	clearValues[0].color.uint32[3] = 0;
+	clearValues[1].depthStencil = {0.f, 0};
+
+	VkRenderPassBeginInfo passInfo = {};
+	passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	passInfo.renderPass = visibilityPass;
+	passInfo.framebuffer = visibilityFramebuffer;
+	passInfo.renderArea.offset = {0, 0};
+	passInfo.renderArea.extent = _windowExtent;
+	passInfo.clearValueCount = 2;
+	passInfo.pClearValues = clearValues;
+
+	VisibilityConstants visibility;
+	visibility.viewProjection = camera_view_projection();
+	visibility.cameraPos = glm::vec4(cameraInfo.pos, 1.f);
+
+	int scope = profiler.begin(cmd, "visibility");
+	vkCmdBeginRenderPass(cmd, &passInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipelineLayout, 0, 1, &computeSet, 0, nullptr);
+	vkCmdPushConstants(cmd, visibilityPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(VisibilityConstants), &visibility);
+
+	//one instance per object, the instance index is the object index and the vertex index / 3 the triangle
+	for (uint i = 0; i < objects.size(); i++) {
+		for (BVHMesh& mesh : bvhMeshes) {
+			if (mesh.rootIndex != objects[i].bvhIndex) continue;
+			vkCmdDraw(cmd, mesh.triCount * 3, 1, mesh.triOffset * 3, i);
+			break;
+		}
+	}
+
+	vkCmdEndRenderPass(cmd);
+	profiler.end(cmd, scope);
+}
+
+//the megakernel specialized for what the current frame actually uses, compiled the first time a combination shows up.
+//a fixed bounce limit lets the compiler bound the path loop, the stats build is only used by the debug views.
+//while the bounce slider is dragged the limit stays a push constant, so only the released value gets compiled
+VkPipeline VulkanEngine::megakernel_variant(bool useRayQuery, bool multiView, bool persistent) {
+	MegakernelSpecialization specialization;
+	specialization.bvhCacheNodes = bvhCacheNodes;
+	specialization.hasSpheres = !orderedSpheres.empty();
+	specialization.debugStats = rayTracerParams.debug >= 0;
+	bool fixedBounces = !bounceLimitEditing && rayTracerParams.bounceLimit < 255;
+	specialization.bounceLimit = fixedBounces ? rayTracerParams.bounceLimit : 0xffffffffu;
+	specialization.pixelMapping = pixelMapping;
+	specialization.groupWidth = megakernelGroupShapes[groupShape].x;
+	specialization.groupHeight = megakernelGroupShapes[groupShape].y;
+	specialization.multiView = multiView;
+	//views share the guide cells, only single view frames train them
+	specialization.guideTraining = !multiView && pathGuiding && guideLearning && guidePipeline != VK_NULL_HANDLE;
+
+	//the key keeps 8 bits of the limit, the dynamic variant is 255
+	uint32_t key = (useRayQuery ? 1 : 0) | specialization.hasSpheres << 1 | specialization.debugStats << 2 | pixelMapping << 3 | groupShape << 5 | multiView << 7 | (specialization.bounceLimit & 0xff) << 8
+		| specialization.guideTraining << 16 | persistent << 17;
+	auto cached = megakernelVariants.find(key);
+	if (cached != megakernelVariants.end()) return cached->second;
+
+	VkSpecializationMapEntry entries[] = {
+		{0, offsetof(MegakernelSpecialization, bvhCacheNodes), sizeof(uint32_t)},
+		{1, offsetof(MegakernelSpecialization, hasSpheres), sizeof(VkBool32)},
+		{2, offsetof(MegakernelSpecialization, debugStats), sizeof(VkBool32)},
+		{3, offsetof(MegakernelSpecialization, bounceLimit), sizeof(uint32_t)},
+		{4, offsetof(MegakernelSpecialization, pixelMapping), sizeof(uint32_t)},
+		{5, offsetof(MegakernelSpecialization, groupWidth), sizeof(uint32_t)},
+		{6, offsetof(MegakernelSpecialization, groupHeight), sizeof(uint32_t)},
+		{7, offsetof(MegakernelSpecialization, multiView), sizeof(VkBool32)},
+		{8, offsetof(MegakernelSpecialization, guideTraining), sizeof(VkBool32)}
+	};
+	VkSpecializationInfo specializationInfo{(uint32_t) std::size(entries), entries, sizeof(MegakernelSpecialization), &specialization};
+
+	auto start = std::chrono::system_clock::now();
+	VkComputePipelineCreateInfo pipelineInfo = vkinit::computePipelineCreateInfo(computePipeLayout);
+	VkShaderModule module = persistent ? (useRayQuery ? rayQueryPersistentModule : persistentModule) : (useRayQuery ? rayQueryModule : megakernelModule);
+	pipelineInfo.stage = vkinit::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, module);
+	pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+	//the per-view loop comparison offsets the batch pipeline's dispatch to one view
+	if (multiView) pipelineInfo.flags |= VK_PIPELINE_CREATE_DISPATCH_BASE_BIT;
+	VkPipeline pipeline;
+	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline));
+	auto end = std::chrono::system_clock::now();
+
+	cout << "Compiled megakernel variant " << (useRayQuery ? "ray query" : "software") << ", spheres " << specialization.hasSpheres << ", stats " << specialization.debugStats
+		<< ", bounces " << (fixedBounces ? std::to_string(specialization.bounceLimit) : "dynamic") << ", mapping " << pixelMapping << ", persistent " << persistent << ", group " << specialization.groupWidth << "x" << specialization.groupHeight << " in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms\n";
+	megakernelVariants.emplace(key, pipeline);
+	return pipeline;
+}
+
+void VulkanEngine::start_mapping_benchmark() {
+	MappingBenchmark& bench = mappingBenchmark;
+	bench.params = rayTracerParams;
+	bench.wavefront = wavefront;
+	bench.pixelMapping = pixelMapping;
+	bench.groupShape = groupShape;
+	bench.primaryHitCache = primaryHitCache;
+	bench.rasterPrimaryHits = rasterPrimaryHits;
+
+	//every configuration runs the plain full screen megakernel without stats, tracing its camera rays every frame
+	primaryHitCache = false;
+	rasterPrimaryHits = false;
+	rayTracerParams.singleRender = false;
+	rayTracerParams.persistentThreads = false;
+	rayTracerParams.debug = -1;
+	if (bench.primaryOnly) rayTracerParams.bounceLimit = 0;
+	wavefront = false;
+
+	bench.running = true;
+	bench.config = 0;
+	bench.frame = 0;
+	bench.time = 0.f;
+	bench.best = -1;
+	pixelMapping = PIXEL_MAPPING_LINEAR;
+	groupShape = 0;
+}
+
+//called once per computed frame with the profiler resolved, moves on to the next configuration after enough frames
+void VulkanEngine::step_mapping_benchmark() {
+	MappingBenchmark& bench = mappingBenchmark;
+	bench.frame++;
+	if (bench.frame > MAPPING_BENCHMARK_WARMUP) {
+		bench.time += profiler.get(rayQuery && rayQueryModule != VK_NULL_HANDLE ? "megakernel (ray query)" : "megakernel");
+	}
+	if (bench.frame < MAPPING_BENCHMARK_WARMUP + MAPPING_BENCHMARK_FRAMES) return;
+
+	bench.results[bench.config] = bench.time / MAPPING_BENCHMARK_FRAMES;
+	bench.config++;
+	bench.frame = 0;
+	bench.time = 0.f;
+
+	if (bench.config < PIXEL_MAPPINGS * MEGAKERNEL_GROUP_SHAPES) {
+		pixelMapping = (PixelMapping) (bench.config / MEGAKERNEL_GROUP_SHAPES);
+		groupShape = bench.config % MEGAKERNEL_GROUP_SHAPES;
+		return;
+	}
+
+	const char* mappingNames[PIXEL_MAPPINGS] = {"row major", "morton", "morton + swizzle"};
+	cout << "Pixel mapping benchmark (" << _windowExtent.width << "x" << _windowExtent.height << ", " << (bench.primaryOnly ? "primary rays" : "full paths") << "):\n";
+	bench.best = 0;
+	for (int i = 0; i < PIXEL_MAPPINGS * MEGAKERNEL_GROUP_SHAPES; i++) {
+		glm::uvec2 shape = megakernelGroupShapes[i % MEGAKERNEL_GROUP_SHAPES];
+		cout << "  " << mappingNames[i / MEGAKERNEL_GROUP_SHAPES] << " " << shape.x << "x" << shape.y << ": " << bench.results[i] << "ms\n";
+		if (bench.results[i] < bench.results[bench.best]) bench.best = i;
+	}
+	cout << "Fastest: " << mappingNames[bench.best / MEGAKERNEL_GROUP_SHAPES] << " " << megakernelGroupShapes[bench.best % MEGAKERNEL_GROUP_SHAPES].x << "x" << megakernelGroupShapes[bench.best % MEGAKERNEL_GROUP_SHAPES].y << "\n";
+
+	rayTracerParams = bench.params;
+	wavefront = bench.wavefront;
+	pixelMapping = bench.pixelMapping;
+	groupShape = bench.groupShape;
+	primaryHitCache = bench.primaryHitCache;
+	rasterPrimaryHits = bench.rasterPrimaryHits;
+	bench.running = false;
+}
+
+//progressive megakernel frames from a cleared accumulation until budget ms have passed or frameLimit frames are in, then the image.
+//firstFrame offsets the frame counter, and so the seeds, of non progressive renders
+std::vector<uint8_t> VulkanEngine::accumulate_for(float budget, uint& frames, uint frameLimit, uint firstFrame) {
+	bool useRayQuery = rayQuery && rayQueryModule != VK_NULL_HANDLE;
+
+	//the renders must not depend on what the guide learned before, so it is off and the variant does not train it
+	bool guiding = pathGuiding;
+	pathGuiding = false;
+	VkPipeline pipeline = megakernel_variant(useRayQuery);
+	if (guideHeader.enabled) {
+		//run_compute writes the real header back on the next frame since the cached one differs
+		guideHeader.enabled = 0;
+		immediate_submit([&](VkCommandBuffer cmd) {
+			vkCmdUpdateBuffer(cmd, guideBuffer.buffer, 0, sizeof(uint32_t) * 2, &guideHeader);
+			compute_barrier(cmd);
+		});
+	}
+	glm::uvec2 groupSize = megakernelGroupShapes[groupShape];
+
+	PushConstants frame = constants;
+	frame.camInfo = cameraInfo;
+	frame.environment = environment;
+	frame.rayTraceParams = rayTracerParams;
+	frame.rayTraceParams.sphereCount = orderedSpheres.size();
+	frame.rayTraceParams.objectCount = objects.size();
+	frame.rayTraceParams.lightCount = lights.size();
+	frame.tileOffset = glm::uvec2(0);
+	frame.primaryHitMode = PRIMARY_HITS_OFF;
+	frame.adaptivePixels = false;
+
+	frames = 0;
+	auto start = std::chrono::system_clock::now();
+	float elapsed = 0.f;
+	while (elapsed < budget && frames < frameLimit) {
+		frame.frameCount = firstFrame + frames++;
+		immediate_submit([&](VkCommandBuffer cmd) {
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeLayout, 0, 1, &computeSet, 0, nullptr);
+			//benchmark references are plain path tracing, whatever the ui has turned on
+			resample_direct_light(cmd, false);
+			write_indirect_header(cmd, false);
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+			vkCmdPushConstants(cmd, computePipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &frame);
+			vkCmdDispatch(cmd, (_windowExtent.width + groupSize.x - 1) / groupSize.x, (_windowExtent.height + groupSize.y - 1) / groupSize.y, 1);
+		});
+		elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - start).count() / 1000.f;
+	}
+	pathGuiding = guiding;
+	return read_compute_image();
+}
+
+//rgba8 copy of the accumulated image, the storage image stays in the general layout
+std::vector<uint8_t> VulkanEngine::read_compute_image() {
+	return read_image(computeImage.image.image, _windowExtent);
+}
+
+//root mean square error over rgb in [0, 1]
+static float image_rmse(const std::vector<uint8_t>& image, const std::vector<uint8_t>& reference) {
+	double sum = 0.0;
+	size_t count = 0;
+	for (size_t i = 0; i < image.size(); i++) {
+		if (i % 4 == 3) continue;
+		double difference = (image[i] - reference[i]) / 255.0;
+		sum += difference * difference;
+		count++;
+	}
+	return count > 0 ? (float) sqrt(sum / count) : 0.f;
+}
+
+//replaces the scene's emitters with 1 to 100k small emissive spheres under the ceiling, all with the same total power,
+//and compares the alias table against the light tree after lightBenchmarkBudget ms each. blocks until done
+void VulkanEngine::run_light_benchmark() {
+	std::vector<Sphere> savedSpheres = spheres;
+	std::vector<uint> savedMaterials;
+	RayTracerData savedParams = rayTracerParams;
+
+	//the scene's own emitters would dominate the small lights, they are white while the benchmark runs
+	for (RenderObject& object : objects) {
+		savedMaterials.push_back(object.materialIndex);
+		if (rayMaterials[object.materialIndex].emissionStrength > 0.f) object.materialIndex = 0;
+	}
+	uint lightMaterial = 0;
+	for (uint i = 0; i < rayMaterials.size(); i++) {
+		if (rayMaterials[i].emissionStrength > 0.f) lightMaterial = i;
+	}
+
+	rayTracerParams.progressive = true;
+	rayTracerParams.singleRender = false;
+	rayTracerParams.persistentThreads = false;
+	rayTracerParams.raysPerPixel = 1;
+	rayTracerParams.debug = -1;
+
+	cout << "Light scaling benchmark (" << _windowExtent.width << "x" << _windowExtent.height << ", " << lightBenchmarkBudget << "ms per render):\n";
+	uint count = 1;
+	for (int scale = 0; scale < LIGHT_BENCHMARK_SCALES; scale++, count *= 10) {
+		//constant total area keeps the total power the same at every scale
+		float radius = 0.1f / sqrt((float) count);
+		spheres.clear();
+		for (uint i = 0; i < count; i++) {
+			glm::vec2 position = glm::vec2(rand(), rand()) / (float) RAND_MAX * 1.8f - 0.9f;
+			spheres.push_back({glm::vec3(position.x, -1.4f, position.y), radius, lightMaterial});
+		}
+		upload_spheres();
+		upload_lights();
+
+		uint frames[3];
+		rayTracerParams.lightTree = true;
+		std::vector<uint8_t> reference = accumulate_for(lightBenchmarkBudget * LIGHT_BENCHMARK_REFERENCE, frames[2]);
+		for (int tree = 0; tree < 2; tree++) {
+			rayTracerParams.lightTree = tree == 1;
+			lightBenchmarkResults[scale][tree] = image_rmse(accumulate_for(lightBenchmarkBudget, frames[tree]), reference);
+		}
+
+		cout << "  " << count << " lights: alias table rmse " << lightBenchmarkResults[scale][0] << " (" << frames[0] << "spp), light tree rmse "
+			<< lightBenchmarkResults[scale][1] << " (" << frames[1] << "spp), reference " << frames[2] << "spp\n";
+	}
+
+	spheres = savedSpheres;
+	for (size_t i = 0; i < objects.size(); i++) objects[i].materialIndex = savedMaterials[i];
+	rayTracerParams = savedParams;
+	upload_spheres();
+	upload_lights();
+	lightBenchmarkDone = true;
+	_frameNumber = 0;
+}
+
+//rmse against a reference averaged from several readbacks, kept in floats so it is finer than any one rgba8 image
+static float image_rmse(const std::vector<uint8_t>& image, const std::vector<float>& reference) {
+	double sum = 0.0;
+	size_t count = 0;
+	for (size_t i = 0; i < image.size(); i++) {
+		if (i % 4 == 3) continue;
+		double difference = image[i] / 255.0 - reference[i];
+		sum += difference * difference;
+		count++;
+	}
+	return count > 0 ? (float) sqrt(sum / count) : 0.f;
+}
+
+//renders the current scene at 1, 4, 16 and 64spp with every sampler and compares them against a 1024spp pcg reference.
+//each render is one non progressive frame so its samples are the first indices of the sequence. blocks until done
+void VulkanEngine::run_sampler_benchmark() {
+	RayTracerData savedParams = rayTracerParams;
+	rayTracerParams.progressive = false;
+	rayTracerParams.singleRender = false;
+	rayTracerParams.persistentThreads = false;
+	rayTracerParams.debug = -1;
+
+	//pcg keeps the reference independent of the samplers being measured
+	uint frames;
+	rayTracerParams.samplerType = SAMPLER_PCG;
+	rayTracerParams.raysPerPixel = 64;
+	std::vector<float> reference(_windowExtent.width * _windowExtent.height * 4, 0.f);
+	for (uint i = 0; i < SAMPLER_BENCHMARK_REFERENCE; i++) {
+		std::vector<uint8_t> image = accumulate_for(INFINITY, frames, 1, i);
+		for (size_t j = 0; j < image.size(); j++) {
+			reference[j] += image[j] / (255.f * SAMPLER_BENCHMARK_REFERENCE);
+		}
+	}
+
+	const char* samplerNames[SAMPLER_TYPES] = {"pcg", "sobol", "blue noise"};
+	cout << "Sampler benchmark (" << _windowExtent.width << "x" << _windowExtent.height << ", " << 64 * SAMPLER_BENCHMARK_REFERENCE << "spp reference):\n";
+	for (uint i = 0; i < SAMPLER_BENCHMARK_COUNTS; i++) {
+		rayTracerParams.raysPerPixel = 1 << (2 * i);
+		cout << "  " << rayTracerParams.raysPerPixel << "spp:";
+		for (uint type = 0; type < SAMPLER_TYPES; type++) {
+			rayTracerParams.samplerType = type;
+			samplerBenchmarkResults[i][type] = image_rmse(accumulate_for(INFINITY, frames, 1), reference);
+			cout << " " << samplerNames[type] << " rmse " << samplerBenchmarkResults[i][type];
+		}
+		cout << "\n";
+	}
+
+	rayTracerParams = savedParams;
+	samplerBenchmarkDone = true;
+	_frameNumber = 0;
+}
+
+//orders every wavefront dispatch/queue reset against the ones before it, including indirect args
+void VulkanEngine::compute_barrier(VkCommandBuffer cmd) {
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	VkPipelineStageFlags srcStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+	VkPipelineStageFlags dstStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+	vkCmdPipelineBarrier(cmd, srcStages, dstStages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void VulkanEngine::reset_wavefront_queue(VkCommandBuffer cmd, uint queue) {
+	QueueHeader empty = {0, 0, 1, 1};
+	vkCmdUpdateBuffer(cmd, wavefrontQueueBuffer.buffer, sizeof(QueueHeader) * queue, sizeof(QueueHeader), &empty);
+}
+
+//queue < 0 dispatches over the whole path pool, otherwise the queue's own indirect args
+void VulkanEngine::dispatch_wavefront(VkCommandBuffer cmd, WavefrontStage stage, int queue, uint bounce) {
+	const char* stageNames[WAVEFRONT_STAGES] = {"generate", "extend", "shade", "connect", "finalize", "sort", "sort", "sort"};
+
+	//coherent camera rays and incoherent bounces are timed apart, the bvh cache helps them differently
+	const char* scopeName = stageNames[stage];
+	if (stage == WAVEFRONT_EXTEND) scopeName = bounce == 0 ? "extend (primary)" : "extend (bounces)";
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, wavefrontPipelines[stage]);
+	int scope = profiler.begin(cmd, scopeName);
+	if (stage == WAVEFRONT_SORT_SCAN) {
+		vkCmdDispatch(cmd, 1, 1, 1);
+	} else if (queue < 0) {
+		vkCmdDispatch(cmd, WAVEFRONT_POOL_SIZE / WAVEFRONT_GROUP_SIZE, 1, 1);
+	} else {
+		vkCmdDispatchIndirect(cmd, wavefrontQueueBuffer.buffer, sizeof(QueueHeader) * queue + offsetof(QueueHeader, groupsX));
+	}
+	profiler.end(cmd, scope);
+	compute_barrier(cmd);
+}
+
+//profiler scopes run_wavefront records, one per stage dispatch
+uint VulkanEngine::wavefront_scopes() {
+	uint pixelCount = _windowExtent.width * _windowExtent.height;
+	uint pools = (pixelCount + WAVEFRONT_POOL_SIZE - 1) / WAVEFRONT_POOL_SIZE;
+	uint samples = rayTracerParams.singleRender ? rayTracerParams.sampleLimit : rayTracerParams.raysPerPixel;
+	uint bounceStages = sortPaths ? 6 : 3;
+	return pools * (samples * (1 + bounceStages * (rayTracerParams.bounceLimit + 1)) + 1);
+}
+
+//counting sort of the active queue into the sorted queue, keyed by hit material and ray direction
+void VulkanEngine::sort_wavefront_queue(VkCommandBuffer cmd, uint bounce) {
+	uint active = bounce & 1;
+	vkCmdFillBuffer(cmd, wavefrontSortBuffer.buffer, 0, sizeof(uint32_t) * WAVEFRONT_SORT_BUCKETS, 0);
+
+	//the sorted queue has the same size (and indirect args) as the one it sorts
+	VkBufferCopy headerCopy;
+	headerCopy.srcOffset = sizeof(QueueHeader) * active;
+	headerCopy.dstOffset = sizeof(QueueHeader) * WAVEFRONT_SORTED_QUEUE;
+	headerCopy.size = sizeof(QueueHeader);
+	vkCmdCopyBuffer(cmd, wavefrontQueueBuffer.buffer, wavefrontQueueBuffer.buffer, 1, &headerCopy);
+	compute_barrier(cmd);
+
+	dispatch_wavefront(cmd, WAVEFRONT_SORT_COUNT, active);
+	dispatch_wavefront(cmd, WAVEFRONT_SORT_SCAN, -1);
+	dispatch_wavefront(cmd, WAVEFRONT_SORT_SCATTER, active);
+}
+
+//one kernel per stage instead of one thread per pixel: generate -> (extend -> [sort] -> shade -> connect) per bounce -> finalize.
+//only paths still alive are dispatched at each bounce, so divergence between short and long paths stops costing idle lanes
+//steps are one sample of one pool, pool after pool. a tiled single render runs a range of them per frame and the
+//pool's paths carry the samples over to the next frame
+void VulkanEngine::run_wavefront(VkCommandBuffer cmd, uint firstStep, uint lastStep) {
+	uint pixelCount = _windowExtent.width * _windowExtent.height;
+	uint samples = rayTracerParams.singleRender ? rayTracerParams.sampleLimit : rayTracerParams.raysPerPixel;
+
+	vkCmdFillBuffer(cmd, wavefrontQueueBuffer.buffer, offsetof(WavefrontQueues, stageCounters), sizeof(uint32_t) * WAVEFRONT_STAGES, 0);
+
+	//the pool is smaller than the screen, so pixels are traced a pool at a time
+	for (uint offset = 0, pool = 0; offset < pixelCount; offset += WAVEFRONT_POOL_SIZE, pool++) {
+		uint poolStep = pool * samples;
+		if (poolStep + samples <= firstStep) continue;
+		if (poolStep >= lastStep) break;
+
+		WavefrontStep step;
+		step.pixelOffset = offset;
+		step.sortPaths = sortPaths;
+
+		for (uint s = 0; s < samples; s++) {
+			if (poolStep + s < firstStep || poolStep + s >= lastStep) continue;
+			step.sample = s;
+			step.bounce = 0;
+			vkCmdPushConstants(cmd, computePipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, offsetof(PushConstants, wavefront), sizeof(WavefrontStep), &step);
+
+			reset_wavefront_queue(cmd, 0);
+			compute_barrier(cmd);
+			dispatch_wavefront(cmd, WAVEFRONT_GENERATE, -1);
+
+			for (uint b = 0; b <= rayTracerParams.bounceLimit; b++) {
+				step.bounce = b;
+				vkCmdPushConstants(cmd, computePipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, offsetof(PushConstants, wavefront), sizeof(WavefrontStep), &step);
+
+				//shade fills the other active queue and the shadow queue
+				reset_wavefront_queue(cmd, (b + 1) & 1);
+				reset_wavefront_queue(cmd, WAVEFRONT_SHADOW_QUEUE);
+				compute_barrier(cmd);
+
+				dispatch_wavefront(cmd, WAVEFRONT_EXTEND, b & 1, b);
+				if (sortPaths) sort_wavefront_queue(cmd, b);
+				dispatch_wavefront(cmd, WAVEFRONT_SHADE, sortPaths ? WAVEFRONT_SORTED_QUEUE : b & 1);
+				dispatch_wavefront(cmd, WAVEFRONT_CONNECT, WAVEFRONT_SHADOW_QUEUE);
+			}
+		}
+
+		if (poolStep + samples <= lastStep) dispatch_wavefront(cmd, WAVEFRONT_FINALIZE, -1);
+	}
+
+	VkBufferCopy counterCopy;
+	counterCopy.srcOffset = offsetof(WavefrontQueues, stageCounters);
+	counterCopy.dstOffset = 0;
+	counterCopy.size = sizeof(uint32_t) * WAVEFRONT_STAGES;
+	vkCmdCopyBuffer(cmd, wavefrontQueueBuffer.buffer, wavefrontStatsBuffer.buffer, 1, &counterCopy);
+
+	VkMemoryBarrier readbackBarrier{};
+	readbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &readbackBarrier, 0, nullptr, 0, nullptr);
+}
+
 void VulkanEngine::run_graphics(uint ind) {
 	VkCommandBufferAllocateInfo cmdBufferAlloc = vkinit::commandBufferAllocateInfo(commandPool);
 	VkCommandBufferBeginInfo cmdBufferInfo = vkinit::commandBufferBeginInfo();
@@ -1779,7 +4308,8 @@ void VulkanEngine::draw() {
 	vkWaitForFences(device, 1, &renderFence, VK_TRUE, 10000000);
 	vkResetFences(device, 1, &renderFence);
 
-	if (totalSamples < rayTracerParams.sampleLimit) {
+	bool computed = totalSamples < rayTracerParams.sampleLimit;
+	if (computed) {
 		//compute
 		run_compute();
 	}
@@ -1807,11 +4337,54 @@ void VulkanEngine::draw() {
 
 	vkQueueWaitIdle(graphicsQueue);
 	end = std::chrono::system_clock::now();    
+
+	if (computed) {
+		profiler.resolve(device);
+
+		//fit the next frame's tiles to the budget from what this frame's took
+		if (tilesDispatched > 0) {
+			float tileTime = profiler.get("tiles") / tilesDispatched;
+			if (tileTime > 0.f) tilesPerFrame = std::max(1, (int) (tileBudget / tileTime));
+		}
+
+		if (mappingBenchmark.running) step_mapping_benchmark();
+
+		activePixelFraction = 1.f;
+		if (adaptiveDispatched) {
+			uint32_t activeCount;
+			void* data;
+			vmaMapMemory(allocator, adaptiveStatsBuffer.allocation, &data);
+			memcpy(&activeCount, data, sizeof(uint32_t));
+			vmaUnmapMemory(allocator, adaptiveStatsBuffer.allocation);
+			activePixelFraction = activeCount / (float) (_windowExtent.width * _windowExtent.height);
+		}
+
+		if (guideUpdated) {
+			void* data;
+			vmaMapMemory(allocator, guideStatsBuffer.allocation, &data);
+			memcpy(&guideCellsUsed, data, sizeof(uint32_t));
+			vmaUnmapMemory(allocator, guideStatsBuffer.allocation);
+		}
+
+		if (wavefront && subgroupSupported) {
+			void* data;
+			vmaMapMemory(allocator, wavefrontStatsBuffer.allocation, &data);
+			memcpy(wavefrontCounters, data, sizeof(wavefrontCounters));
+			vmaUnmapMemory(allocator, wavefrontStatsBuffer.allocation);
+		}
+	}
 	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
 
-	_frameNumber = rayTracerParams.progressive ? _frameNumber + 1 : 0;
-	totalSamples += (totalSamples < rayTracerParams.sampleLimit ? rayTracerParams.sampleLimit : 0);
-	if (!rayTracerParams.singleRender) totalSamples = 0;
+	//a tiled render counts as one frame, and only once every tile is in
+	bool midRender = tilesDispatched > 0 && nextTile < tileCount;
+	if (!midRender) {
+		_frameNumber = rayTracerParams.progressive ? _frameNumber + 1 : 0;
+		totalSamples += (totalSamples < rayTracerParams.sampleLimit ? rayTracerParams.sampleLimit : 0);
+	}
+	if (!rayTracerParams.singleRender) {
+		totalSamples = 0;
+		nextTile = 0;
+	}
 }
 
 void VulkanEngine::run() {
@@ -12,8 +12,11 @@
 
 #include <vk_mem_alloc.h>
 #include <vk_mesh.h>
+#include <vk_profiler.h>
+#include <vk_sampler.h>
 
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtx/transform.hpp>
 #define GLM_ENABLE_EXPERIMENT
 #include <glm/gtx/string_cast.hpp>
@@ -61,6 +64,13 @@ struct Triangle {
 	alignas(16) glm::vec3 tangent;
 };
 
+//intersection only triangle, same index as triangles (bvh leaf order)
+struct TriangleIntersect {
+	glm::vec4 v0; //w = frontOnly
+	glm::vec4 edge1; //v1 - v0
+	glm::vec4 edge2; //v2 - v0
+};
+
 struct TrianglePoint {
 	alignas(16) glm::vec4 position; //uv.x is position.w
 	alignas(16) glm::vec4 normal; //uv.y is normal.w
@@ -78,6 +88,40 @@ struct RayMaterial {
 	alignas(4) int bumpIndex = -1;
 };
 
+enum LightShape {
+	LIGHT_TRIANGLE, //emits from both faces
+	LIGHT_TRIANGLE_FRONT,
+	LIGHT_SPHERE //v0 = center, edge1.x = radius
+};
+
+//world space emitter plus its alias table entry, mirrors LightSource in raytrace_common.glsl
+struct LightSource {
+	alignas(16) glm::vec3 v0;
+	alignas(4) float area;
+	alignas(16) glm::vec3 edge1;
+	alignas(4) float selectPDF; //power / total power
+	alignas(16) glm::vec3 edge2;
+	alignas(4) float aliasProbability;
+	alignas(16) glm::vec3 emission;
+	alignas(4) uint alias;
+	alignas(16) glm::vec3 normal;
+	alignas(4) uint shape; //LightShape
+};
+
+//light tree node, one light per leaf and children next to each other
+struct LightNode {
+	alignas(16) glm::vec3 boundsMin = glm::vec3(1e30f);
+	alignas(4) float power = 0.f;
+	alignas(16) glm::vec3 boundsMax = glm::vec3(-1e30f);
+	alignas(4) float cosTheta = 1.f; //normal cone half angle around axis, -1 = emits everywhere
+	alignas(16) glm::vec3 axis = glm::vec3(0.f, 1.f, 0.f);
+	alignas(4) uint child = 0;
+	alignas(4) uint first = 0; //lights range under the node
+	alignas(4) uint count = 0;
+};
+
+const uint NO_LIGHT = 0xffffffff;
+
 struct BoundingBox {
 	glm::vec4 bounds[2] = {glm::vec4(1e30f), glm::vec4(-1e30f)};
 	void grow(TrianglePoint v0) {
@@ -120,6 +164,10 @@ struct RenderObject {
 	alignas(4) uint bvhIndex;
 	alignas(4) uint materialIndex;
 	alignas(4) uint samplerIndex = 0;
+	alignas(4) uint triOffset = 0; //first triangle of the mesh, ray query hits are relative to it
+	alignas(4) uint cacheOffset = 0; //where the mesh's top bvh levels start in the shared memory cache
+	alignas(4) uint cacheCount = 0; //0 = not cached
+	alignas(4) uint lightOffset = 0; //lightSlots entry of the mesh's first triangle, only set when the material emits
 };
 
 struct ImGuiObject {
@@ -157,6 +205,40 @@ struct EnvironmentData {
 	alignas(16) glm::vec4 lightDir = glm::vec4(normalize(glm::vec3(2.f, 0.8f, -3.f)), 0.f); //w component = environment on
 };
 
+//header of the EnvironmentMap buffer (binding 29), the texels follow it
+struct EnvironmentMapHeader {
+	uint width = 0; //0 = no map loaded, the analytic sky is used
+	uint height = 0;
+	uint enabled = 1;
+	float intensity = 1.f;
+};
+
+//header of the GuideCache buffer (binding 31), then the cell keys, the training sums and the cdfs
+struct GuideHeader {
+	uint enabled = 0;
+	float cellSize = 0.25f;
+	uint cellsUsed = 0; //counted by the gpu
+	uint padding = 0;
+};
+
+//header of the Reservoirs buffer (binding 32), then RESERVOIR_SIZE bytes per pixel for each of the RESERVOIR_SETS.
+//the GIReservoirs buffer (binding 33) starts with the same header
+struct ReservoirHeader {
+	CameraInfo previousCamera;
+	uint frame = 0; //parity picks which final set is written
+	uint history = 0; //0 = the previous frame's reservoirs are stale
+	uint enabled = 0; //the megakernel shades its primary hits with the reservoirs
+	uint spatial = 1;
+};
+
+//random numbers behind every path decision, mirrors sampler.glsl
+enum SamplerType {
+	SAMPLER_PCG = 0,
+	SAMPLER_SOBOL,
+	SAMPLER_BLUE_NOISE,
+	SAMPLER_TYPES
+};
+
 struct RayTracerData {
 	alignas(4) bool progressive = false;
 	alignas(4) bool singleRender = false;
@@ -168,6 +250,19 @@ struct RayTracerData {
 	alignas(4) uint triangleCap = 50;
 	alignas(4) uint boxCap = 200;
 	alignas(4) uint sampleLimit = 10;
+	alignas(4) bool persistentThreads = false;
+	alignas(4) uint lightCount = 0;
+	alignas(4) bool lightTree = true;
+	alignas(4) uint samplerType = SAMPLER_SOBOL;
+	alignas(4) float adaptiveThreshold = 0.02f; //relative standard error a pixel stops sampling at
+};
+
+//which sample/bounce a wavefront dispatch works on, pushed on its own between dispatches
+struct WavefrontStep {
+	alignas(4) uint sample = 0;
+	alignas(4) uint bounce = 0;
+	alignas(4) uint pixelOffset = 0;
+	alignas(4) bool sortPaths = false;
 };
 
 struct PushConstants {
@@ -175,8 +270,107 @@ struct PushConstants {
 	EnvironmentData environment; //52 -> 64
 	RayTracerData rayTraceParams; //20 -> 32
 	uint frameCount;
+	WavefrontStep wavefront;
+	alignas(8) glm::uvec2 tileOffset = glm::uvec2(0); //first pixel of a single render tile
+	alignas(4) uint primaryHitMode = 0; //PrimaryHitMode
+	alignas(4) bool adaptivePixels = false; //the megakernel only traces the pixels adaptive_compact.comp listed
+};
+
+//what the megakernel does with the primary hit image, mirrors raytrace.comp
+enum PrimaryHitMode {
+	PRIMARY_HITS_OFF = 0,
+	PRIMARY_HITS_FILL,
+	PRIMARY_HITS_READ,
+	PRIMARY_HITS_RASTER
+};
+
+//visibility.vert/frag, the view projection reproduces cameraRay so raster and traced hits line up
+struct VisibilityConstants {
+	glm::mat4 viewProjection;
+	glm::vec4 cameraPos;
 };	
 
+//wavefront path tracing, mirrors wavefront_common.glsl
+enum WavefrontStage {
+	WAVEFRONT_GENERATE = 0,
+	WAVEFRONT_EXTEND,
+	WAVEFRONT_SHADE,
+	WAVEFRONT_CONNECT,
+	WAVEFRONT_FINALIZE,
+	WAVEFRONT_SORT_COUNT,
+	WAVEFRONT_SORT_SCAN,
+	WAVEFRONT_SORT_SCATTER,
+	WAVEFRONT_STAGES
+};
+
+struct QueueHeader {
+	uint count;
+	uint groupsX; //groupsX/Y/Z are the VkDispatchIndirectCommand of the stage consuming the queue
+	uint groupsY;
+	uint groupsZ;
+};
+
+struct WavefrontQueues {
+	QueueHeader queues[4]; //0/1 = active paths (ping-pong per bounce), 2 = shadow rays, 3 = sorted active paths
+	uint stageCounters[WAVEFRONT_STAGES];
+};
+
+struct WavefrontPath {
+	alignas(16) glm::vec3 origin;
+	alignas(4) uint rngState;
+	alignas(16) glm::vec3 dir;
+	alignas(4) uint bounce;
+	alignas(16) glm::vec3 attenuation;
+	alignas(4) float bsdfPDF;
+	alignas(16) glm::vec3 totalColor;
+	alignas(4) float boxTests;
+	alignas(16) glm::vec3 directLight;
+	alignas(4) float triTests;
+	alignas(16) glm::vec3 sampleSum;
+	alignas(4) uint pixelIndex;
+	alignas(4) float shadowBoxTests;
+	alignas(4) float shadowTriTests;
+};
+
+//traversal result only, attributes are resolved in the shade stage
+struct HitRecord {
+	alignas(4) float dst;
+	alignas(8) glm::vec2 bary;
+	alignas(4) uint primIndex;
+	alignas(4) uint objectIndex;
+};
+
+struct WavefrontShadowRay {
+	alignas(16) glm::vec3 origin;
+	alignas(4) float bsdfPDF;
+	alignas(16) glm::vec3 dir;
+	alignas(4) float tMax;
+	alignas(16) glm::vec3 brdf;
+	alignas(4) float lightPDF;
+	alignas(16) glm::vec3 emission;
+};
+
+//pixel to invocation order of the megakernel, mirrors PIXEL_MAPPING in raytrace.comp
+enum PixelMapping {
+	PIXEL_MAPPING_LINEAR = 0,
+	PIXEL_MAPPING_MORTON,
+	PIXEL_MAPPING_SWIZZLE,
+	PIXEL_MAPPINGS
+};
+
+//specialization constants of raytrace.comp, ids in declaration order
+struct MegakernelSpecialization {
+	uint32_t bvhCacheNodes;
+	VkBool32 hasSpheres;
+	VkBool32 debugStats;
+	uint32_t bounceLimit;
+	uint32_t pixelMapping;
+	uint32_t groupWidth;
+	uint32_t groupHeight;
+	VkBool32 multiView;
+	VkBool32 guideTraining;
+};
+
 struct RenderStats {
 	float frameTime;
 	float drawTime;
@@ -193,6 +387,21 @@ struct BVHBin {
 	uint triCount = 0;
 };
 
+//one per built mesh, objects sharing a mesh point at the same root
+struct BVHMesh {
+	uint rootIndex;
+	uint triOffset;
+	uint triCount;
+	uint cacheOffset = 0;
+	uint cacheCount = 0;
+};
+
+struct AccelerationStructure {
+	VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
+	AllocatedBuffer buffer;
+	VkDeviceAddress address = 0;
+};
+
 struct BVHStats {
 	uint minDepth = 4294967295;
 	uint maxDepth = 0;
@@ -203,7 +412,48 @@ constexpr unsigned int FRAME_OVERLAP = 2;
 constexpr unsigned int BINS = 20;
 constexpr unsigned int MAX_TEXTURES = 64;
 const unsigned int MAX_MATERIALS = 10;
-const unsigned int MAX_SPHERES = 10;
+constexpr unsigned int SPHERE_LEAF_SIZE = 4;
+constexpr unsigned int MAX_BVH_CACHE_LEVELS = 8;
+constexpr unsigned int WAVEFRONT_POOL_SIZE = 1 << 19; //paths in flight, larger screens are traced in chunks
+constexpr unsigned int WAVEFRONT_GROUP_SIZE = 64;
+constexpr unsigned int WAVEFRONT_SHADOW_QUEUE = 2;
+constexpr unsigned int WAVEFRONT_SORTED_QUEUE = 3;
+constexpr unsigned int WAVEFRONT_SORT_BUCKETS = 256;
+constexpr unsigned int GUIDE_CELLS = 16384; //mirrors guiding.glsl
+constexpr unsigned int GUIDE_BINS = 64;
+constexpr size_t GUIDE_BUFFER_SIZE = sizeof(GuideHeader) + sizeof(uint32_t) * GUIDE_CELLS * (1 + 2 * GUIDE_BINS);
+constexpr unsigned int RESERVOIR_SIZE = 32; //mirrors restir.glsl
+constexpr unsigned int RESERVOIR_SETS = 3; //final reservoirs of this and the previous frame, then the temporal pass output
+constexpr unsigned int GI_RESERVOIR_SIZE = 48; //mirrors restir_gi.glsl
+constexpr unsigned int GI_RESERVOIR_SETS = 4; //final reservoirs of this and the previous frame, the megakernel's, the temporal pass output
+constexpr unsigned int GI_PIXEL_SIZE = 32;
+constexpr unsigned int MEGAKERNEL_GROUP_SHAPES = 4;
+const glm::uvec2 megakernelGroupShapes[MEGAKERNEL_GROUP_SHAPES] = {{8, 8}, {16, 4}, {32, 2}, {4, 16}};
+constexpr unsigned int MAPPING_BENCHMARK_WARMUP = 4;
+constexpr unsigned int MAPPING_BENCHMARK_FRAMES = 16;
+constexpr unsigned int LIGHT_BENCHMARK_SCALES = 6; //1 to 100k lights, x10 each step
+constexpr unsigned int LIGHT_BENCHMARK_REFERENCE = 8; //reference renders get this many budgets
+constexpr unsigned int SAMPLER_BENCHMARK_COUNTS = 4; //1 to 64spp, x4 each step
+constexpr unsigned int SAMPLER_BENCHMARK_REFERENCE = 16; //reference frames of 64spp each, averaged on the cpu
+
+//sweeps every pixel mapping and workgroup shape, timing the megakernel on the current scene
+struct MappingBenchmark {
+	bool running = false;
+	bool primaryOnly = true; //bounce limit 0, isolates camera ray coherence
+	uint config = 0; //mapping * MEGAKERNEL_GROUP_SHAPES + shape
+	uint frame = 0;
+	float time = 0.f;
+	float results[PIXEL_MAPPINGS * MEGAKERNEL_GROUP_SHAPES] = {}; //ms per frame
+	int best = -1;
+
+	//restored once the sweep is done
+	RayTracerData params;
+	bool wavefront;
+	PixelMapping pixelMapping;
+	int groupShape;
+	bool primaryHitCache;
+	bool rasterPrimaryHits;
+};
 
 class VulkanEngine {
 private:
@@ -214,6 +464,7 @@ private:
 	void init_framebuffers();
 	void init_sync_structures();
 	void init_pipelines();
+	void init_visibility_pass();
 	void init_descriptors();
 	void init_imgui();
 	void init_image();
@@ -225,6 +476,20 @@ private:
 	void read_mtl(std::string filePath);
 	void build_bvh(int size, int triIndex, BoundingBox scene);
 	void update_bvh_bounds(uint index);
+	void reorder_bvh_breadth_first(uint root);
+	uint bvh_level_nodes(uint root, uint levels);
+	void layout_bvh_cache();
+	void build_sphere_bvh();
+	void upload_spheres();
+	void write_sphere_descriptors();
+	void build_light_list();
+	void build_light_tree(uint node, uint first, uint count, std::vector<uint>& order, std::vector<glm::vec3>& centers, uint& nodesUsed);
+	void upload_lights();
+	void write_light_descriptors();
+	bool load_environment_map(const char* file);
+	void upload_environment_map();
+	void write_environment_descriptors();
+	void update_object_meshes();
 	void subdivide_bvh(uint intex, uint depth, BVHStats& stats, BoundingBox scene);
 	float find_bvh_split_plane(BVHNode& node, int& axis, float& splitPos, BoundingBox scene);
 	float scene_interior_cost(BoundingBox node, BoundingBox scene);
@@ -236,6 +501,38 @@ private:
 
 	void imgui_draw();
 	void run_compute();
+	uint wavefront_scopes();
+	void run_wavefront(VkCommandBuffer cmd, uint firstStep = 0, uint lastStep = ~0u);
+	void dispatch_wavefront(VkCommandBuffer cmd, WavefrontStage stage, int queue, uint bounce = 0);
+	void reset_wavefront_queue(VkCommandBuffer cmd, uint queue);
+	void sort_wavefront_queue(VkCommandBuffer cmd, uint bounce);
+	void compute_barrier(VkCommandBuffer cmd);
+	VkPipeline megakernel_variant(bool useRayQuery, bool multiView = false, bool persistent = false);
+	void allocate_views(uint count, VkExtent2D extent);
+	void write_view_descriptors();
+	void turntable_views(uint count);
+	void render_views();
+	void compare_view_loop();
+	void save_view(uint layer, const char* path);
+	std::vector<uint8_t> read_image(VkImage image, VkExtent2D extent, uint layer = 0);
+	void start_mapping_benchmark();
+	void step_mapping_benchmark();
+	std::vector<uint8_t> accumulate_for(float budget, uint& frames, uint frameLimit = UINT32_MAX, uint firstFrame = 0);
+	std::vector<uint8_t> read_compute_image();
+	void run_light_benchmark();
+	void run_sampler_benchmark();
+	void build_acceleration_structures();
+	void run_backend_benchmark(uint frames);
+	void build_tlas();
+	AccelerationStructure create_acceleration_structure(VkAccelerationStructureTypeKHR type, VkDeviceSize size);
+	VkDeviceAddress buffer_address(VkBuffer buffer);
+	void rasterize_primary_hits(VkCommandBuffer cmd);
+	void compact_active_pixels(VkCommandBuffer cmd);
+	void update_guide(VkCommandBuffer cmd);
+	void resample_direct_light(VkCommandBuffer cmd, bool enabled);
+	void write_indirect_header(VkCommandBuffer cmd, bool enabled);
+	void resample_indirect_light(VkCommandBuffer cmd);
+	glm::mat4 camera_view_projection();
 	void run_graphics(uint index);
 
 	void cornell_box();
@@ -268,7 +565,22 @@ public:
 	VkCommandPool commandPool;
 
 	std::vector<Sphere> spheres;
+	std::vector<Sphere> orderedSpheres; //leaf order, what the gpu sees
+	std::vector<BVHNode> sphereNodes;
+	size_t sphereCapacity = 0; //spheres the buffers hold, the bvh buffer holds 2x nodes
 	std::vector<RayMaterial> rayMaterials;
+	std::vector<LightSource> lights; //every emissive triangle and sphere in tree leaf order, rebuilt when materials, spheres or transforms change
+	std::vector<LightNode> lightNodes;
+	std::vector<uint> lightSlots; //sphere index, then object lightOffset + mesh triangle, to lights index
+	size_t lightCapacity = 0; //the tree buffer holds 2x nodes
+	size_t lightSlotCapacity = 0;
+	float lightPower = 0.f; //sum of luminance * area over lights
+	EnvironmentMapHeader environmentMap;
+	std::vector<glm::vec4> environmentTexels;
+	std::vector<float> environmentCDF; //marginal cdf over the rows, then a conditional cdf per row
+	size_t environmentCapacity = 0; //texels the map buffer holds
+	size_t environmentCDFCapacity = 0;
+	char environmentMapFile[256] = "../assets/environment.hdr";
 	std::vector<Texture> textures;
 	std::vector<TrianglePoint> triPoints;
 	std::vector<Triangle> triangles;
@@ -279,6 +591,11 @@ public:
 	uint texturesUsed = 0;
 
 	std::vector<BVHNode> bvhNodes;
+	std::vector<BVHMesh> bvhMeshes;
+	float bvhBuildTime = 0.f; //ms, summed over every mesh
+	bool bvhCache = true;
+	uint bvhCacheLevels = 0;
+	uint bvhCacheNodes = 1; //specialization constant, shared memory nodes per workgroup
 	BoundingBox scene;
 	uint nodesUsed = 0;
 	uint rot = 0;
@@ -295,19 +612,74 @@ public:
 	AllocatedBuffer vertexBuffer;
 	AllocatedBuffer indexBuffer;
 	Texture computeImage;
+	Texture primaryHitImage; //rgba32ui, see PrimaryHitMode
+	Texture accumulationImage; //rgba32f running mean, a = frames accumulated by the pixel
+	Texture luminanceM2Image; //r32f, variance of the frame luminances * (frames - 1)
 
 	AllocatedBuffer sphereBuffer;
+	AllocatedBuffer sphereBvhBuffer;
+	AllocatedBuffer lightBuffer;
+	AllocatedBuffer lightTreeBuffer;
+	AllocatedBuffer lightSlotBuffer;
+	AllocatedBuffer samplerTableBuffer; //vkutil::SamplerTables
+	AllocatedBuffer environmentMapBuffer; //EnvironmentMapHeader, then the texels
+	AllocatedBuffer environmentCDFBuffer;
 	AllocatedBuffer triPointBuffer;
 	AllocatedBuffer materialBuffer;
 	AllocatedBuffer triangleBuffer;
+	AllocatedBuffer triIntersectBuffer;
 	AllocatedBuffer objectBuffer;
 	AllocatedBuffer bvhBuffer;
+	AllocatedBuffer workQueueBuffer;
+	AllocatedBuffer adaptiveBuffer; //megakernel indirect args, active pixel count, then the active pixels
+	AllocatedBuffer adaptiveStatsBuffer; //active pixel count read back after each frame
+	AllocatedBuffer guideBuffer; //GuideHeader, then the guide cache
+	AllocatedBuffer guideStatsBuffer; //cells used, read back after each guide update
+	AllocatedBuffer reservoirBuffer; //ReservoirHeader, then the reservoirs
+	AllocatedBuffer giReservoirBuffer; //ReservoirHeader, then the restir gi reservoirs
+	AllocatedBuffer giPixelBuffer; //megakernel colors and albedos waiting for their indirect light
+
+	AllocatedBuffer wavefrontQueueBuffer;
+	AllocatedBuffer wavefrontItemBuffer;
+	AllocatedBuffer wavefrontPathBuffer;
+	AllocatedBuffer wavefrontHitBuffer;
+	AllocatedBuffer wavefrontShadowBuffer;
+	AllocatedBuffer wavefrontSortBuffer; //bucket counts, bucket offsets, then a (key, rank) per queue slot
+	AllocatedBuffer wavefrontStatsBuffer; //stage counters read back after each frame
 
 	VkPipelineLayout graphicsPipelineLayout;
 	VkPipeline graphicsPipeline;
 
 	VkPipelineLayout computePipeLayout;
-	VkPipeline computePipeline;
+	VkShaderModule megakernelModule = VK_NULL_HANDLE;
+	VkShaderModule rayQueryModule = VK_NULL_HANDLE;
+	VkShaderModule persistentModule = VK_NULL_HANDLE; //raytrace.comp built with PERSISTENT_THREADS, null without subgroup ops
+	VkShaderModule rayQueryPersistentModule = VK_NULL_HANDLE; //both defines, needs ray queries and subgroup ops
+	std::unordered_map<uint32_t, VkPipeline> megakernelVariants;
+	bool bounceLimitEditing = false; //the slider is held, frames use the dynamic bounce variant until it is released
+	VkPipeline wavefrontPipelines[WAVEFRONT_STAGES];
+	VkPipeline adaptivePipeline = VK_NULL_HANDLE;
+	VkPipeline guidePipeline = VK_NULL_HANDLE;
+	VkPipeline restirPipelines[2] = {VK_NULL_HANDLE, VK_NULL_HANDLE}; //candidates + temporal reuse, spatial reuse
+	VkPipeline restirGIPipelines[2] = {VK_NULL_HANDLE, VK_NULL_HANDLE}; //temporal reuse, spatial reuse + store
+
+	//hardware traversal, only loaded when the device has acceleration structures and ray queries
+	PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR;
+	PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructureKHR;
+	PFN_vkDestroyAccelerationStructureKHR vkDestroyAccelerationStructureKHR;
+	PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR;
+	PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR;
+	PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR;
+
+	std::vector<AccelerationStructure> blases; //one per bvh mesh
+	AccelerationStructure tlas;
+	AllocatedBuffer tlasInstanceBuffer;
+	AllocatedBuffer tlasScratchBuffer;
+	AllocatedBuffer rqIndexBuffer;
+	float accelBuildTime = 0.f; //ms, blases and tlas
+	float backendTraceTimes[2] = {0.f, 0.f}; //ms per frame, software bvh then ray query, from the last benchmark
+
+	GpuProfiler profiler;
 
 	VkSemaphore presentSemaphore, renderSemaphore, computeSemaphore, graphicsSemaphore;
 	VkFence renderFence, computeFence;
@@ -335,6 +707,102 @@ public:
 	bool autoProgressive = true;
 	float cameraSpeed = 10.f;
 
+	//persistent threads and the wavefront queues need subgroup ballot/vote to batch their atomics
+	bool subgroupSupported = false;
+	uint persistentWorkgroups = 512; //replaced by the device's resident workgroups in init_vulkan when it reports them
+
+	bool rayQuerySupported = false;
+	bool rayQuery = false;
+	VkDeviceSize scratchAlignment = 1;
+
+	//single renders are traced a few tiles per frame within a gpu time budget
+	bool tiledSingleRender = true;
+	int tileSize = 128;
+	float tileBudget = 30.f; //ms of gpu time per frame
+	uint nextTile = 0;
+	uint tileCount = 0;
+	uint tilesPerFrame = 1;
+	uint tilesDispatched = 0;
+
+	PixelMapping pixelMapping = PIXEL_MAPPING_LINEAR;
+	int groupShape = 0; //index into megakernelGroupShapes
+	MappingBenchmark mappingBenchmark;
+
+	//many light scaling: rmse against a long reference after a fixed time, power only vs light tree
+	float lightBenchmarkBudget = 500.f; //ms per render
+	float lightBenchmarkResults[LIGHT_BENCHMARK_SCALES][2] = {}; //rmse, [0] = alias table, [1] = light tree
+	bool lightBenchmarkDone = false;
+
+	//sampler convergence: rmse against a high sample count reference at equal sample counts
+	float samplerBenchmarkResults[SAMPLER_BENCHMARK_COUNTS][SAMPLER_TYPES] = {};
+	bool samplerBenchmarkDone = false;
+
+	//progressive megakernel frames only trace the pixels whose mean is still noisier than adaptiveThreshold
+	bool adaptiveSampling = false;
+	bool adaptiveDispatched = false;
+	float activePixelFraction = 1.f;
+
+	//path guiding: megakernel paths train a hashed grid of directional histograms that diffuse bounces sample from
+	bool pathGuiding = false;
+	bool guideLearning = true; //off freezes what was learned so far
+	float guideCellSize = 0.25f;
+	int guideUpdateInterval = 4; //frames of training per update
+	bool guideReset = true; //clears the cache before the next frame
+	bool guideUpdated = false;
+	uint guideFrames = 0; //trained since the last update
+	uint guideIteration = 0;
+	uint guideCellsUsed = 0;
+	GuideHeader guideHeader; //last one written to the gpu
+
+	//restir: the megakernel's primary hits take their light from per pixel reservoirs reused across frames and neighbours
+	bool restir = false;
+	bool restirTemporal = true;
+	bool restirSpatial = true;
+	uint restirFrame = 0;
+	bool restirHistory = false; //the reservoirs written last frame can be reprojected
+	CameraInfo restirCamera; //camera the last reservoirs were built with
+
+	//restir gi: the megakernel's first bsdf bounces are reused across frames and neighbours for the primary hits' indirect light
+	bool restirGI = false;
+	bool restirGITemporal = true;
+	bool restirGISpatial = true;
+	uint giFrame = 0;
+	bool giHistory = false;
+	CameraInfo giCamera;
+
+	//camera ray hits are traced once and reused until the camera or a scene buffer changes
+	bool primaryHitCache = true;
+	bool primaryHitsValid = false;
+	CameraInfo primaryHitCamera;
+
+	//camera ray hits of triangles rasterized into primaryHitImage instead of traced
+	bool rasterPrimaryHits = true;
+	VkRenderPass visibilityPass;
+	VkFramebuffer visibilityFramebuffer;
+	AllocatedImage visibilityDepth;
+	VkImageView visibilityDepthView;
+	VkPipelineLayout visibilityPipelineLayout;
+	VkPipeline visibilityPipeline = VK_NULL_HANDLE;
+
+	//batch rendering: every camera in views traced into its own layer of viewImage by a single dispatch
+	std::vector<CameraInfo> views;
+	VkExtent2D viewExtent{256, 256};
+	VkExtent2D viewImageExtent{0, 0}; //what viewImage was allocated at
+	uint viewCapacity = 0; //layers in viewImage, cameras in viewBuffer
+	AllocatedBuffer viewBuffer;
+	AllocatedImage viewImage;
+	VkImageView viewImageView;
+	int turntableViews = 16;
+	float viewBatchTime = 0.f; //ms, gpu time of the dispatch
+	float viewBatchHostTime = 0.f; //ms, submission to fence
+	float viewLoopTime = 0.f; //ms, gpu time of the same views dispatched one submission each
+	float viewLoopHostTime = 0.f; //ms, submission to fence summed over those submissions
+	int viewShown = 0; //layer the ui saves
+
+	bool wavefront = false;
+	bool sortPaths = false;
+	uint wavefrontCounters[WAVEFRONT_STAGES] = {};
+
 	VkExtent2D _windowExtent{1728, 1117};
 
 	struct SDL_Window* _window{nullptr};
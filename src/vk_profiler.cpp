@@ -0,0 +1,102 @@
+#include <vk_profiler.h>
+#include <iostream>
+#include <algorithm>
+
+//timestampValidBits is the queue family's, 0 means its timestamps carry nothing
+void GpuProfiler::init(VkDevice device, const VkPhysicalDeviceProperties& properties, uint32_t timestampValidBits, uint32_t scopeCount) {
+	supported = properties.limits.timestampComputeAndGraphics && properties.limits.timestampPeriod > 0 && timestampValidBits > 0;
+	if (!supported) {
+		std::cout << "gpu timestamps not supported, stage timings disabled" << std::endl;
+		return;
+	}
+
+	timestampPeriod = properties.limits.timestampPeriod;
+	timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+	reserve(device, scopeCount);
+}
+
+void GpuProfiler::destroy(VkDevice device) {
+	if (queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(device, queryPool, nullptr);
+	queryPool = VK_NULL_HANDLE;
+}
+
+//grows the pool to hold scopeCount scopes, only while no recorded command buffer still uses it
+void GpuProfiler::reserve(VkDevice device, uint32_t scopeCount) {
+	scopeCount = std::min(scopeCount, MAX_SCOPES);
+	if (!supported || scopeCount * 2 <= maxQueries) return;
+
+	destroy(device);
+	maxQueries = scopeCount * 2;
+
+	VkQueryPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	poolInfo.queryCount = maxQueries;
+	if (vkCreateQueryPool(device, &poolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+		std::cout << "failed to create timestamp query pool" << std::endl;
+		queryPool = VK_NULL_HANDLE;
+		maxQueries = 0;
+		supported = false;
+	}
+}
+
+void GpuProfiler::reset(VkCommandBuffer cmd) {
+	queriesUsed = 0;
+	droppedScopes = 0;
+	scopeNames.clear();
+	if (supported) vkCmdResetQueryPool(cmd, queryPool, 0, maxQueries);
+}
+
+int GpuProfiler::begin(VkCommandBuffer cmd, const char* name) {
+	//out of queries just drops the scope instead of failing the frame, the ui shows how many were lost
+	if (!supported) return -1;
+	if (queriesUsed + 2 > maxQueries) {
+		droppedScopes++;
+		return -1;
+	}
+
+	int scope = scopeNames.size();
+	scopeNames.push_back(name);
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, queriesUsed);
+	queriesUsed += 2;
+	return scope;
+}
+
+void GpuProfiler::end(VkCommandBuffer cmd, int scope) {
+	if (scope < 0) return;
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, scope * 2 + 1);
+}
+
+//call once the command buffer has finished executing
+void GpuProfiler::resolve(VkDevice device) {
+	if (!supported || queriesUsed == 0) return;
+
+	std::vector<uint64_t> results(queriesUsed);
+	VkResult result = vkGetQueryPoolResults(device, queryPool, 0, queriesUsed, results.size() * sizeof(uint64_t), results.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+	queriesUsed = 0;
+	if (result != VK_SUCCESS) return;
+
+	timings.clear();
+	for (size_t i = 0; i < scopeNames.size(); i++) {
+		//masking the difference also handles a counter that wrapped inside the scope
+		uint64_t ticks = ((results[i * 2 + 1] & timestampMask) - (results[i * 2] & timestampMask)) & timestampMask;
+		float ms = ticks * timestampPeriod / 1000000.f;
+
+		bool found = false;
+		for (auto& timing : timings) {
+			if (timing.first == scopeNames[i]) {
+				timing.second += ms;
+				found = true;
+				break;
+			}
+		}
+		if (!found) timings.push_back({scopeNames[i], ms});
+	}
+}
+
+float GpuProfiler::get(const char* name) {
+	for (auto& timing : timings) {
+		if (timing.first == name) return timing.second;
+	}
+	return 0.f;
+}
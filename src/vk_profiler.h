@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vk_types.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+//gpu timestamps around dispatches, scopes with the same name are summed so a stage that runs every bounce shows up once
+struct GpuProfiler {
+	static constexpr uint32_t MAX_SCOPES = 1 << 19;
+
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	uint32_t maxQueries = 0;
+	uint32_t queriesUsed = 0;
+	float timestampPeriod = 1.f; //ns per tick
+	uint64_t timestampMask = ~0ull; //the valid bits of a timestamp, the rest are undefined
+	bool supported = false;
+	uint32_t droppedScopes = 0; //scopes that found the pool full since the last reset
+
+	std::vector<std::string> scopeNames;
+	std::vector<std::pair<std::string, float>> timings; //ms, in first recorded order
+
+	void init(VkDevice device, const VkPhysicalDeviceProperties& properties, uint32_t timestampValidBits, uint32_t scopeCount);
+	void destroy(VkDevice device);
+	void reserve(VkDevice device, uint32_t scopeCount);
+
+	void reset(VkCommandBuffer cmd);
+	int begin(VkCommandBuffer cmd, const char* name);
+	void end(VkCommandBuffer cmd, int scope);
+	void resolve(VkDevice device);
+
+	float get(const char* name);
+};
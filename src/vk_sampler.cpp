@@ -0,0 +1,145 @@
+#include <vk_sampler.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+//joe and kuo's direction numbers for sobol dimensions 2 to 4: degree, polynomial coefficients, initial m values
+struct SobolPolynomial {
+	uint32_t degree;
+	uint32_t coefficients;
+	uint32_t m[3];
+};
+
+static const SobolPolynomial sobolPolynomials[vkutil::SOBOL_DIMENSIONS - 1] = {
+	{1, 0, {1, 0, 0}},
+	{2, 1, {1, 3, 0}},
+	{3, 1, {1, 3, 1}},
+};
+
+void vkutil::build_sobol_matrices(uint32_t* matrices) {
+	//the first dimension is the van der corput sequence
+	for (uint32_t bit = 0; bit < SOBOL_BITS; bit++) {
+		matrices[bit] = 1u << (SOBOL_BITS - 1 - bit);
+	}
+
+	for (uint32_t dimension = 1; dimension < SOBOL_DIMENSIONS; dimension++) {
+		const SobolPolynomial& polynomial = sobolPolynomials[dimension - 1];
+		uint32_t s = polynomial.degree;
+		uint32_t* v = matrices + dimension * SOBOL_BITS;
+		for (uint32_t bit = 0; bit < SOBOL_BITS; bit++) {
+			if (bit < s) {
+				v[bit] = polynomial.m[bit] << (SOBOL_BITS - 1 - bit);
+				continue;
+			}
+			v[bit] = v[bit - s] ^ (v[bit - s] >> s);
+			for (uint32_t k = 1; k < s; k++) {
+				if ((polynomial.coefficients >> (s - 1 - k)) & 1u) v[bit] ^= v[bit - k];
+			}
+		}
+	}
+}
+
+void vkutil::build_blue_noise(float* mask, uint32_t size) {
+	const uint32_t count = size * size;
+	const float sigma = 1.5f;
+
+	//gaussian of the toroidal distance, indexed by the wrapped offset between two pixels
+	std::vector<float> kernel(count);
+	for (uint32_t y = 0; y < size; y++) {
+		for (uint32_t x = 0; x < size; x++) {
+			float dx = (float) std::min(x, size - x);
+			float dy = (float) std::min(y, size - y);
+			kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+		}
+	}
+
+	std::vector<uint8_t> pattern(count, 0);
+	std::vector<float> energy(count, 0.f);
+	auto splat = [&](uint32_t pixel, float sign) {
+		uint32_t px = pixel % size;
+		uint32_t py = pixel / size;
+		for (uint32_t y = 0; y < size; y++) {
+			const float* row = kernel.data() + ((y + size - py) % size) * size;
+			for (uint32_t x = 0; x < size; x++) {
+				energy[y * size + x] += sign * row[(x + size - px) % size];
+			}
+		}
+	};
+	auto set = [&](uint32_t pixel, bool on) {
+		pattern[pixel] = on;
+		splat(pixel, on ? 1.f : -1.f);
+	};
+	auto tightest_cluster = [&]() {
+		uint32_t best = 0;
+		float bestEnergy = -1.f;
+		for (uint32_t i = 0; i < count; i++) {
+			if (pattern[i] && energy[i] > bestEnergy) {
+				bestEnergy = energy[i];
+				best = i;
+			}
+		}
+		return best;
+	};
+	auto largest_void = [&]() {
+		uint32_t best = 0;
+		float bestEnergy = INFINITY;
+		for (uint32_t i = 0; i < count; i++) {
+			if (!pattern[i] && energy[i] < bestEnergy) {
+				bestEnergy = energy[i];
+				best = i;
+			}
+		}
+		return best;
+	};
+
+	//initial binary pattern: a tenth of the pixels, seeded deterministically so every run gets the same mask
+	uint32_t seed = 0x9e3779b9u;
+	uint32_t initialOnes = count / 10;
+	for (uint32_t placed = 0; placed < initialOnes;) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		uint32_t pixel = seed % count;
+		if (pattern[pixel]) continue;
+		set(pixel, true);
+		placed++;
+	}
+
+	//move ones from the tightest cluster into the largest void until the pattern is evenly spread
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t cluster = tightest_cluster();
+		set(cluster, false);
+		uint32_t hole = largest_void();
+		set(hole, true);
+		if (hole == cluster) break;
+	}
+	std::vector<uint8_t> prototype = pattern;
+	std::vector<float> prototypeEnergy = energy;
+
+	//phase 1: rank the prototype's ones by removing the tightest cluster first
+	std::vector<uint32_t> rank(count, 0);
+	for (uint32_t ones = initialOnes; ones > 0; ones--) {
+		uint32_t cluster = tightest_cluster();
+		set(cluster, false);
+		rank[cluster] = ones - 1;
+	}
+
+	//phase 2 and 3: fill the largest void until every pixel is ranked. ulichney switches to the tightest cluster
+	//of zeros past half way, but the energies of ones and zeros always sum to the same kernel total so both pick the same pixel
+	pattern = prototype;
+	energy = prototypeEnergy;
+	for (uint32_t ones = initialOnes; ones < count; ones++) {
+		uint32_t hole = largest_void();
+		set(hole, true);
+		rank[hole] = ones;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		mask[i] = (rank[i] + 0.5f) / count;
+	}
+}
+
+void vkutil::build_sampler_tables(SamplerTables& tables) {
+	build_sobol_matrices(tables.sobolMatrices);
+	build_blue_noise(tables.blueNoise, BLUE_NOISE_SIZE);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+//tables behind the low discrepancy samplers in sampler.glsl, built once on the cpu
+namespace vkutil {
+	constexpr uint32_t SOBOL_DIMENSIONS = 4;
+	constexpr uint32_t SOBOL_BITS = 32;
+	constexpr uint32_t BLUE_NOISE_SIZE = 64;
+
+	//layout of the SamplerTables buffer (binding 25)
+	struct SamplerTables {
+		uint32_t sobolMatrices[SOBOL_DIMENSIONS * SOBOL_BITS];
+		float blueNoise[BLUE_NOISE_SIZE * BLUE_NOISE_SIZE];
+	};
+
+	//generator matrix columns of the first SOBOL_DIMENSIONS sobol dimensions, column i is the point of index 1 << i
+	void build_sobol_matrices(uint32_t* matrices);
+	//void and cluster mask (ulichney 1993) on a size x size torus, every pixel gets its rank / (size * size)
+	void build_blue_noise(float* mask, uint32_t size);
+	void build_sampler_tables(SamplerTables& tables);
+}
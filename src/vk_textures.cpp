@@ -199,17 +199,16 @@ bool vkutil::load_images_from_file(VulkanEngine& engine, const char* files[], Al
     return true;
 }
 
-void vkutil::create_empty_image(VulkanEngine& engine, AllocatedImage& outImage, VkExtent2D extent) {
+void vkutil::create_empty_image(VulkanEngine& engine, AllocatedImage& outImage, VkExtent2D extent, VkFormat format, VkImageUsageFlags extraUsage) {
 	auto start = std::chrono::system_clock::now();
     VkDeviceSize size = extent.width * extent.height * 4;
-    VkFormat imageFormat = VK_FORMAT_R8G8B8A8_SRGB;
 
     VkExtent3D imageExtent;
     imageExtent.width = extent.width;
     imageExtent.height = extent.height;
     imageExtent.depth = 1;
 
-    VkImageCreateInfo imageInfo = vkinit::imageCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT, imageExtent);
+    VkImageCreateInfo imageInfo = vkinit::imageCreateInfo(format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT | extraUsage, imageExtent);
     
     AllocatedImage image;
     VmaAllocationCreateInfo imgAllocInfo{};
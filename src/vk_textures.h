@@ -6,6 +6,6 @@
 namespace vkutil {
     bool load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage& outImage); 
     bool load_images_from_file(VulkanEngine& engine, const char* files[], AllocatedImage* outImages[], int size);
-    void create_empty_image(VulkanEngine& engine, AllocatedImage& outImage, VkExtent2D extent);
+    void create_empty_image(VulkanEngine& engine, AllocatedImage& outImage, VkExtent2D extent, VkFormat format = VK_FORMAT_R8G8B8A8_SRGB, VkImageUsageFlags extraUsage = 0);
     void create_empty_images(VulkanEngine& engine, AllocatedImage* outImages, VkExtent2D extent, int size);
 }
\ No newline at end of file